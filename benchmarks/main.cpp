@@ -1,6 +1,7 @@
 #include <chrono>
 #include <iostream>
 #include <fstream>
+#include <iomanip>
 #include <stack>
 #include <random>
 #include "../include/xtree.hpp"
@@ -154,6 +155,101 @@ void benchmark_parse(const std::string& file_path, int count, bool from_mem) {
         << std::endl;
 }
 
+void benchmark_parse_parallel(const std::string& file_path, int count) {
+    std::string str = string_from_file(file_path);
+
+    auto stats_total = stat_document(file_path);
+
+    double ete_time = 0.0;
+
+    for (int i = 0; i < count; i++) {
+        auto start = std::chrono::steady_clock::now();
+
+        xtree::Document::from_buffer_parallel(str.data(), str.size());
+
+        auto stop = std::chrono::steady_clock::now();
+        ete_time += std::chrono::duration<double, std::milli>(stop - start).count();
+    }
+
+    OUT << std::setw(35) << file_path
+        << std::setw(10) << "Parallel"
+        << std::setw(15) << std::to_string(count) + " runs"
+        << std::setw(20) << to_rounded_string(static_cast<double>(str.size()) / 1e3) + " kb/file"
+        << std::setw(15) << to_rounded_string(ete_time) + " ms"
+        << std::setw(20) << to_rounded_string(ete_time / count) + " ms/file"
+        << std::setw(15) << to_rounded_string(((double) str.size() * (double) count / 1e6) / (ete_time / 1e3)) + " mb/s"
+        << std::setw(20) << to_rounded_string(static_cast<double>(stats_total.total_mem) / 1e3) + " kb/file"
+        << std::setw(20) << std::to_string(stats_total.nodes_count) + " nodes/file"
+        << std::endl;
+}
+
+void benchmark_parse_view(const std::string& file_path, int count) {
+    std::string str = string_from_file(file_path);
+
+    auto stats_total = xtree::stat_document(xtree::DocumentView::from_buffer(str.data(), str.size()));
+
+    double ete_time = 0.0;
+
+    for (int i = 0; i < count; i++) {
+        auto start = std::chrono::steady_clock::now();
+
+        xtree::DocumentView::from_buffer(str.data(), str.size());
+
+        auto stop = std::chrono::steady_clock::now();
+        ete_time += std::chrono::duration<double, std::milli>(stop - start).count();
+    }
+
+    OUT << std::setw(35) << file_path
+        << std::setw(10) << "View"
+        << std::setw(15) << std::to_string(count) + " runs"
+        << std::setw(20) << to_rounded_string(static_cast<double>(str.size()) / 1e3) + " kb/file"
+        << std::setw(15) << to_rounded_string(ete_time) + " ms"
+        << std::setw(20) << to_rounded_string(ete_time / count) + " ms/file"
+        << std::setw(15) << to_rounded_string(((double) str.size() * (double) count / 1e6) / (ete_time / 1e3)) + " mb/s"
+        << std::setw(20) << to_rounded_string(static_cast<double>(stats_total.total_mem) / 1e3) + " kb/file"
+        << std::setw(20) << std::to_string(stats_total.nodes_count) + " nodes/file"
+        << std::endl;
+}
+
+struct CountHandler : public xtree::SaxHandler {
+    size_t nodes_count = 0;
+
+    void on_decl(std::string_view, const std::vector<xtree::AttrView>&) override { nodes_count++; }
+    void on_dtd(std::string_view) override { nodes_count++; }
+    void on_open(std::string_view, const std::vector<xtree::AttrView>&) override { nodes_count++; }
+    void on_text(std::string_view) override { nodes_count++; }
+    void on_cmnt(std::string_view) override { nodes_count++; }
+};
+
+void benchmark_parse_sax(const std::string& file_path, int count) {
+    std::string str = string_from_file(file_path);
+
+    double ete_time = 0.0;
+    size_t nodes_count = 0;
+
+    for (int i = 0; i < count; i++) {
+        auto start = std::chrono::steady_clock::now();
+
+        CountHandler handler;
+        xtree::sax_from_buffer(str.data(), str.size(), handler);
+        nodes_count = handler.nodes_count;
+
+        auto stop = std::chrono::steady_clock::now();
+        ete_time += std::chrono::duration<double, std::milli>(stop - start).count();
+    }
+
+    OUT << std::setw(35) << file_path
+        << std::setw(10) << "Sax"
+        << std::setw(15) << std::to_string(count) + " runs"
+        << std::setw(20) << to_rounded_string(static_cast<double>(str.size()) / 1e3) + " kb/file"
+        << std::setw(15) << to_rounded_string(ete_time) + " ms"
+        << std::setw(20) << to_rounded_string(ete_time / count) + " ms/file"
+        << std::setw(15) << to_rounded_string(((double) str.size() * (double) count / 1e6) / (ete_time / 1e3)) + " mb/s"
+        << std::setw(20) << "0.00 kb/file"
+        << std::setw(20) << std::to_string(nodes_count) + " nodes/file"
+        << std::endl;
+}
+
 void benchmark_print(const std::string& file_path, int count) {
     auto document = xtree::Document::from_file(file_path);
 
@@ -275,6 +371,11 @@ int main() {
         benchmark_parse("../input/gie_file2.xml", 10, true);
         benchmark_parse("../input/random_dump.xml", 1, false);
         benchmark_parse("../input/random_dump.xml", 1, true);
+        benchmark_parse_parallel("../input/random_dump.xml", 1);
+        benchmark_parse_view("../input/gie_file.xml", 10);
+        benchmark_parse_view("../input/random_dump.xml", 1);
+        benchmark_parse_sax("../input/gie_file.xml", 10);
+        benchmark_parse_sax("../input/random_dump.xml", 1);
 
         std::cout << "Finished benchmark Parsing" << std::endl;
     } catch (std::exception& ex) {
@@ -7,6 +7,32 @@
 #include <fstream>
 #include <cassert>
 #include <optional>
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <exception>
+#include <unordered_map>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#define MMAP_FILES true
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define MMAP_FILES false
+#include <io.h>
+#endif
 #include "xtree.hpp"
 
 using namespace xtree;
@@ -14,20 +40,313 @@ using namespace xtree;
 typedef long long i64;
 typedef int i32;
 
+// finds the first character in [begin, end) that is one of the delimiters, or end if there is none
+// compares a whole vector register of characters at a time when SSE2 or AVX2 is available
+template <char... Delims>
+static const char* scan_delims(const char* begin, const char* end) {
+#if defined(__AVX2__)
+    while (end - begin >= 32) {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+        __m256i match = _mm256_setzero_si256();
+        ((match = _mm256_or_si256(match, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(Delims)))), ...);
+
+        auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(match));
+        if (mask != 0)
+            return begin + std::countr_zero(mask);
+        begin += 32;
+    }
+#endif
+#if defined(__SSE2__)
+    while (end - begin >= 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+        __m128i match = _mm_setzero_si128();
+        ((match = _mm_or_si128(match, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(Delims)))), ...);
+
+        auto mask = static_cast<uint32_t>(_mm_movemask_epi8(match));
+        if (mask != 0)
+            return begin + std::countr_zero(mask);
+        begin += 16;
+    }
+#endif
+    for (; begin < end; begin++) {
+        char c = *begin;
+        if (((c == Delims) || ...))
+            return begin;
+    }
+    return end;
+}
+
+// the classes of a byte, looked up in a table instead of calling the locale dependent character functions
+enum CharClass : uint8_t {
+    SPACE_CHAR = 1, // the whitespace of the xml spec, which unlike isspace excludes vertical tabs and form feeds
+    NAME_START_CHAR = 2,
+    NAME_CHAR = 4,
+    MULTI_BYTE_CHAR = 8, // the lead and continuation bytes of utf-8 sequences, whose class depends on the decoded code point
+};
+
+static constexpr std::array<uint8_t, 256> CHAR_CLASSES = [] {
+    std::array<uint8_t, 256> classes{};
+    for (char c: {' ', '\t', '\n', '\r'})
+        classes[static_cast<unsigned char>(c)] |= SPACE_CHAR;
+    for (int c = 'a'; c <= 'z'; c++)
+        classes[c] |= NAME_START_CHAR | NAME_CHAR;
+    for (int c = 'A'; c <= 'Z'; c++)
+        classes[c] |= NAME_START_CHAR | NAME_CHAR;
+    for (char c: {':', '_'})
+        classes[static_cast<unsigned char>(c)] |= NAME_START_CHAR | NAME_CHAR;
+    for (int c = '0'; c <= '9'; c++)
+        classes[c] |= NAME_CHAR;
+    for (char c: {'-', '.'})
+        classes[static_cast<unsigned char>(c)] |= NAME_CHAR;
+    for (int c = 0x80; c <= 0xFF; c++)
+        classes[c] |= MULTI_BYTE_CHAR;
+    return classes;
+}();
+
+static bool is_space(i64 c) {
+    return (CHAR_CLASSES[static_cast<unsigned char>(c)] & SPACE_CHAR) != 0;
+}
+
+// finds the end of the run of single byte name characters at begin, the first of which must also be a name start character if start is set
+static const char* scan_name(const char* begin, const char* end, bool start) {
+    if (start) {
+        if (begin == end || (CHAR_CLASSES[static_cast<unsigned char>(*begin)] & NAME_START_CHAR) == 0)
+            return begin;
+        begin++;
+    }
+    while (begin < end && (CHAR_CLASSES[static_cast<unsigned char>(*begin)] & NAME_CHAR) != 0)
+        begin++;
+    return begin;
+}
+
+// the length of the utf-8 sequence that begins with the lead byte, or 0 if it cannot begin a sequence
+static size_t utf8_length(unsigned char lead) {
+    if (lead >= 0xC2 && lead <= 0xDF)
+        return 2;
+    if (lead >= 0xE0 && lead <= 0xEF)
+        return 3;
+    if (lead >= 0xF0 && lead <= 0xF4)
+        return 4;
+    return 0;
+}
+
+// decodes a utf-8 sequence of the length given by its lead byte, returns false if it is malformed, overlong or a surrogate
+static bool decode_utf8(const unsigned char* seq, size_t len, uint32_t& code_point) {
+    static constexpr uint32_t MIN_CODE_POINTS[] = {0, 0, 0x80, 0x800, 0x10000};
+
+    code_point = seq[0] & (0x7F >> len);
+    for (size_t i = 1; i < len; i++) {
+        if ((seq[i] & 0xC0) != 0x80)
+            return false;
+        code_point = (code_point << 6) | (seq[i] & 0x3F);
+    }
+    return code_point >= MIN_CODE_POINTS[len] && code_point <= 0x10FFFF && (code_point < 0xD800 || code_point > 0xDFFF);
+}
+
+// the multi byte ranges of NameStartChar in the xml spec
+static bool is_name_start_code_point(uint32_t cp) {
+    return (cp >= 0xC0 && cp <= 0xD6) || (cp >= 0xD8 && cp <= 0xF6) || (cp >= 0xF8 && cp <= 0x2FF)
+        || (cp >= 0x370 && cp <= 0x37D) || (cp >= 0x37F && cp <= 0x1FFF) || (cp >= 0x200C && cp <= 0x200D)
+        || (cp >= 0x2070 && cp <= 0x218F) || (cp >= 0x2C00 && cp <= 0x2FEF) || (cp >= 0x3001 && cp <= 0xD7FF)
+        || (cp >= 0xF900 && cp <= 0xFDCF) || (cp >= 0xFDF0 && cp <= 0xFFFD) || (cp >= 0x10000 && cp <= 0xEFFFF);
+}
+
+// the multi byte ranges of NameChar in the xml spec
+static bool is_name_code_point(uint32_t cp) {
+    return is_name_start_code_point(cp) || cp == 0xB7 || (cp >= 0x300 && cp <= 0x36F) || (cp >= 0x203F && cp <= 0x2040);
+}
+
+// encodes a code point as utf-8 into out, returns the number of bytes written
+static size_t encode_utf8(uint32_t code_point, char* out) {
+    if (code_point < 0x80) {
+        out[0] = static_cast<char>(code_point);
+        return 1;
+    }
+    if (code_point < 0x800) {
+        out[0] = static_cast<char>(0xC0 | (code_point >> 6));
+        out[1] = static_cast<char>(0x80 | (code_point & 0x3F));
+        return 2;
+    }
+    if (code_point < 0x10000) {
+        out[0] = static_cast<char>(0xE0 | (code_point >> 12));
+        out[1] = static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+        out[2] = static_cast<char>(0x80 | (code_point & 0x3F));
+        return 3;
+    }
+    out[0] = static_cast<char>(0xF0 | (code_point >> 18));
+    out[1] = static_cast<char>(0x80 | ((code_point >> 12) & 0x3F));
+    out[2] = static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+    out[3] = static_cast<char>(0x80 | (code_point & 0x3F));
+    return 4;
+}
+
+// decodes the digits of a numeric character reference such as &#123; or &#x1F; into a code point that is a Char in the xml spec
+static bool decode_char_ref(std::string_view digits, uint32_t& code_point) {
+    uint32_t base = 10;
+    if (!digits.empty() && digits[0] == 'x') {
+        base = 16;
+        digits.remove_prefix(1);
+    }
+    // any valid code point has at most eight digits, so longer references are rejected before they can overflow
+    if (digits.empty() || digits.size() > 8)
+        return false;
+
+    code_point = 0;
+    for (char c: digits) {
+        uint32_t digit;
+        if (c >= '0' && c <= '9')
+            digit = c - '0';
+        else if (base == 16 && c >= 'a' && c <= 'f')
+            digit = c - 'a' + 10;
+        else if (base == 16 && c >= 'A' && c <= 'F')
+            digit = c - 'A' + 10;
+        else
+            return false;
+        code_point = code_point * base + digit;
+    }
+
+    if (code_point < 0x20)
+        return code_point == 0x9 || code_point == 0xA || code_point == 0xD;
+    return code_point <= 0xD7FF || (code_point >= 0xE000 && code_point <= 0xFFFD) || (code_point >= 0x10000 && code_point <= 0x10FFFF);
+}
+
+// decodes an escape sequence from its '&' to its ';' into out, returns the number of bytes written or 0 if it is not a valid escape
+// the predefined entities are told apart by their length and second character before being compared
+// the decoded characters are never longer than the escape, so they can be written over it
+static size_t decode_escseq(std::string_view seq, char* out) {
+    switch (seq.size()) {
+    case 4:
+        if (seq[1] == 'l' && seq == "&lt;") {
+            out[0] = '<';
+            return 1;
+        }
+        if (seq[1] == 'g' && seq == "&gt;") {
+            out[0] = '>';
+            return 1;
+        }
+        break;
+    case 5:
+        if (seq == "&amp;") {
+            out[0] = '&';
+            return 1;
+        }
+        break;
+    case 6:
+        if (seq[1] == 'q' && seq == "&quot;") {
+            out[0] = '"';
+            return 1;
+        }
+        if (seq[1] == 'a' && seq == "&apos;") {
+            out[0] = '\'';
+            return 1;
+        }
+        break;
+    default:
+        break;
+    }
+
+    uint32_t code_point;
+    if (seq.size() > 3 && seq[1] == '#' && decode_char_ref(seq.substr(2, seq.size() - 3), code_point))
+        return encode_utf8(code_point, out);
+    return 0;
+}
+
+// a row and col of the input counted from 1, which the parser only computes when it reports an error
+struct TextPosition {
+    size_t row = 1;
+    size_t col = 1;
+
+    // the position after the characters in [begin, end)
+    TextPosition advanced(const char* begin, const char* end) const {
+        auto rows = static_cast<size_t>(std::count(begin, end, '\n'));
+        if (rows == 0)
+            return {row, col + static_cast<size_t>(end - begin)};
+
+        auto rend = std::make_reverse_iterator(begin);
+        auto last_newline = std::find(std::make_reverse_iterator(end), rend, '\n');
+        return {row + rows, 1 + static_cast<size_t>(last_newline - std::make_reverse_iterator(end))};
+    }
+};
+
 struct StreamReader {
+    static constexpr size_t BLOCK_SIZ = 64 * 1024; // number of characters requested from the stream per refill
+    static constexpr bool stable = false; // blocks are overwritten on each refill, so strings cannot be borrowed from them
+    static constexpr bool in_place = false;
+    static constexpr bool contiguous = false;
+
+    static constexpr size_t TAIL_SIZ = 16; // at least the parser's lookahead, which may read past the end of a block
+
     std::istream& stream;
+    std::unique_ptr<char[]> buffer;
+    size_t position = 0;
+    size_t size = 0;
+
+    // the offset and position of the block, and the last characters of the previous block, so an error can be located after a refill
+    size_t block_offset = 0;
+    TextPosition block_position;
+    char tail[TAIL_SIZ];
+    size_t tail_size = 0;
+    TextPosition tail_position;
+
+    explicit StreamReader(std::istream& stream) : stream(stream), buffer(new char[BLOCK_SIZ]) {}
+
+    // replaces the buffer with the next block of the stream, returns false if the stream is exhausted
+    bool fill() {
+        if (size > 0) {
+            tail_size = std::min(size, TAIL_SIZ);
+            tail_position = block_position.advanced(buffer.get(), buffer.get() + size - tail_size);
+            std::memcpy(tail, buffer.get() + size - tail_size, tail_size);
+            block_position = tail_position.advanced(tail, tail + tail_size);
+            block_offset += size;
+        }
 
-    explicit StreamReader(std::istream& stream) : stream(stream) {}
+        auto count = stream.rdbuf()->sgetn(buffer.get(), BLOCK_SIZ);
+        position = 0;
+        size = count > 0 ? static_cast<size_t>(count) : 0;
+        return size > 0;
+    }
 
     i32 get() {
-        return stream.get();
+        if (position >= size && !fill())
+            return EOF;
+        return static_cast<unsigned char>(buffer[position++]);
+    }
+
+    // the unread characters of the current block, refilling the block from the stream when it is empty
+    std::string_view block() {
+        if (position >= size)
+            fill();
+        return {buffer.get() + position, size - position};
+    }
+
+    void advance(size_t len) {
+        position += len;
+    }
+
+    // characters can only be handed back while they are still in the current block
+    bool unget(size_t len) {
+        if (len > position)
+            return false;
+        position -= len;
+        return true;
+    }
+
+    // the row and col of the character at offset, which is either in the current block or the tail of the previous one
+    TextPosition locate(size_t offset) const {
+        if (offset >= block_offset)
+            return block_position.advanced(buffer.get(), buffer.get() + (offset - block_offset));
+        return tail_position.advanced(tail, tail + (offset - (block_offset - tail_size)));
     }
 };
 
 struct StringReader {
+    static constexpr bool stable = true; // the input outlives the parser, so strings can be borrowed from it
+    static constexpr bool in_place = false;
+    static constexpr bool contiguous = true; // the whole input is in data, so the parser can look ahead by indexing it
+
     const char* data;
     const size_t size;
-    int position = 0;
+    size_t position = 0;
 
     explicit StringReader(const char* data, size_t size) : data(data), size(size) {}
 
@@ -36,7 +355,81 @@ struct StringReader {
             return EOF;
         return data[position++];
     }
+
+    // the characters that have not been read yet, which can be scanned without calling get
+    std::string_view block() const {
+        return {data + position, size - position};
+    }
+
+    void advance(size_t len) {
+        position += len;
+    }
+
+    bool unget(size_t len) {
+        position -= len;
+        return true;
+    }
+
+    // the row and col of the character at offset, counted from the start of the input
+    TextPosition locate(size_t offset) const {
+        return TextPosition{}.advanced(data, data + offset);
+    }
+};
+
+// a reader over a buffer the parser is allowed to overwrite, so decoded strings are written over the characters they were read from
+struct InPlaceReader : StringReader {
+    static constexpr bool in_place = true;
+
+    explicit InPlaceReader(char* data, size_t size) : StringReader(data, size) {}
+};
+
+#if MMAP_FILES
+// a read-only mapping of a regular file that is unmapped on destruction, files that cannot be mapped are left unmapped
+struct MappedFile {
+    const char* data = nullptr;
+    size_t size = 0;
+    bool mapped = false;
+
+    explicit MappedFile(const std::string& path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("could not open file " + path);
+
+        struct stat st{};
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+            close(fd);
+            return;
+        }
+
+        size = static_cast<size_t>(st.st_size);
+        if (size == 0) {
+            close(fd);
+            mapped = true;
+            return;
+        }
+
+        void* addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED)
+            return;
+
+        // the parser reads the file front to back, so pages can be read ahead aggressively and reclaimed once passed
+        madvise(addr, size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+        madvise(addr, size, MADV_HUGEPAGE);
+#endif
+        data = static_cast<const char*>(addr);
+        mapped = true;
+    }
+
+    MappedFile(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        if (data != nullptr)
+            munmap(const_cast<char*>(data), size);
+    }
 };
+#endif
 
 struct RingBuffer {
     static constexpr int LB_SIZ = 12; // maximum number of characters we can look ahead
@@ -63,15 +456,47 @@ struct RingBuffer {
         size--;
         return c;
     }
+
+    void clear() {
+        head = 0;
+        tail = 0;
+        size = 0;
+    }
 };
 
+// a string read by the parser, which either borrows its characters from the input or owns a range of the parser's scratch buffer
+struct Slice {
+    const char* data = nullptr;
+    size_t offset = 0;
+    size_t size = 0;
+    bool copied = false;
+};
+
+// parses a document from a reader, emitting the nodes it reads to a handler instead of building a tree itself
+// a handler receives the following events, where views are only guaranteed to be valid during the call
+// on_open(tag, attrs), on_close(tag), on_text(data), on_cmnt(data), on_decl(tag, attrs), on_dtd(data)
+// contiguous readers are read through their data, size and position directly, other readers are looked ahead through the ring buffer
 template <class Reader>
 struct Parser {
-    int row = 1;
-    int col = 1;
+    size_t offset = 0; // the number of characters consumed, the row and col are only computed from it when an error is reported
     Reader& reader;
     RingBuffer rb;
 
+    std::string scratch; // holds the strings of the current token that could not be borrowed from the input
+    std::vector<std::pair<Slice, Slice>> attr_slices;
+    std::vector<AttrView> attrs; // the attrs of the current tag, resolved once the tag is closed
+
+    std::vector<std::string_view> open_tags; // the tags of the unclosed elems for readers with stable input, innermost last
+    std::string open_tag_names; // the tags of the unclosed elems for readers without stable input, concatenated
+    std::vector<size_t> open_tag_ends;
+
+    bool parsed_root = false;
+    bool parsed_meta = false;
+
+    // set when a step fails, the functions below return false (or error_tok) up to the step instead of throwing
+    bool failed = false;
+    ParseFailure failure;
+
     explicit Parser(Reader& reader) : reader(reader) {}
 
     i64 read_char() {
@@ -79,21 +504,47 @@ struct Parser {
         if (c == EOF)
             return EOF;
 
-        if (c == '\n') {
-            col = 1;
-            row += 1;
-        }
-        else {
-            col += 1;
-        }
+        offset++;
         return c;
     }
 
     void consume(size_t len) {
+        if constexpr (Reader::contiguous) {
+            consume_run(std::min(len, reader.size - reader.position));
+            return;
+        }
         for (size_t i = 0; i < len; i++) read_char();
     }
 
+    // hands the characters held in the lookahead buffer back to the reader so the reader's block starts at the next character to parse
+    bool sync_block() {
+        if constexpr (Reader::contiguous)
+            return true;
+        if (rb.size == 0)
+            return true;
+        if (!reader.unget(rb.size))
+            return false;
+        rb.clear();
+        return true;
+    }
+
+    // the address of the next character to parse, only meaningful for readers with stable input
+    const char* cursor() {
+        if constexpr (Reader::contiguous)
+            return reader.data + reader.position;
+        sync_block();
+        return reader.block().data();
+    }
+
+    // consumes a run of characters taken from the reader's block
+    void consume_run(size_t len) {
+        reader.advance(len);
+        offset += len;
+    }
+
     i64 get_char() {
+        if constexpr (Reader::contiguous)
+            return reader.get();
         i32 c;
         if (rb.size == 0)
             c = reader.get();
@@ -107,6 +558,13 @@ struct Parser {
     }
 
     i64 peek_ahead(int index) {
+        if constexpr (Reader::contiguous) {
+            size_t position = reader.position + index;
+            if (position >= reader.size)
+                return EOF;
+            return reader.data[position];
+        }
+
         int buf_size = rb.size;
         for (int i = 0; i < index - buf_size + 1; i++) {
             int c = reader.get();
@@ -120,8 +578,19 @@ struct Parser {
         return c;
     }
 
-    bool read_match(const std::string& str, int skip) {
-        int str_size = static_cast<int>(str.size());
+    // consumes the literal str if it follows the next skip characters, along with the skipped characters
+    template <size_t N>
+    bool read_match(const char (&str)[N], int skip) {
+        constexpr int str_size = static_cast<int>(N - 1);
+        if constexpr (Reader::contiguous) {
+            // the literal's length is known at compile time, so the comparison is unrolled into a few wide loads
+            size_t len = skip + str_size;
+            if (reader.size - reader.position < len || std::memcmp(reader.data + reader.position + skip, str, str_size) != 0)
+                return false;
+            consume_run(len);
+            return true;
+        }
+
         int buf_size = rb.size;
 
         // we will read maximally skip + str_size ahead in the scan loop, so ensure the lbuf is pre-filled
@@ -143,21 +612,29 @@ struct Parser {
             }
         }
 
-        consume(skip + str.size());
+        consume(skip + str_size);
         return true;
     }
 
-    bool read_match(const std::string& str) {
+    template <size_t N>
+    bool read_match(const char (&str)[N]) {
         return read_match(str, 0);
     }
 
     void skip_spaces() {
+        if constexpr (Reader::contiguous) {
+            size_t len = 0;
+            while (reader.position + len < reader.size && is_space(reader.data[reader.position + len]))
+                len++;
+            consume_run(len);
+            return;
+        }
         while (true) {
             auto c = peek_char();
             if (c == EOF) {
                 return;
             }
-            if (isspace(c)) {
+            if (is_space(c)) {
                 read_char();
             }
             else {
@@ -166,201 +643,345 @@ struct Parser {
         }
     }
 
-    ParseException parse_error(const std::string& message, ParseError code) const {
-        std::string error_message = message + " at row: " + std::to_string(row) + ", col: " + std::to_string(col);
-        return ParseException(error_message, code);
+    // records the error at the current offset, the row and col are only counted if it is thrown or its message is formatted
+    bool fail(std::string detail, ParseError code) {
+        failed = true;
+        failure.code = code;
+        failure.offset = offset;
+        failure.detail = std::move(detail);
+        return false;
+    }
+
+    ParseException parse_exception() const {
+        auto position = reader.locate(failure.offset);
+        std::string error_message = failure.detail + " at row: " + std::to_string(position.row) + ", col: " + std::to_string(position.col);
+        return ParseException(error_message, failure.code, failure.offset);
     }
 
     static std::string char_string(i64 c) {
         return {static_cast<char>(c), 1};
     }
 
-    static void append_symbol(std::string& str, i64 c) {
-        str += static_cast<char>(c);
+    std::string_view view(const Slice& slice) const {
+        if (slice.copied)
+            return {scratch.data() + slice.offset, slice.size};
+        return {slice.data, slice.size};
     }
 
-    // reads into the buffer argument to avoid an additional allocation and erases after finished
-    void read_escseq(std::string& str) {
-        int i = 0;
-        while (true) {
-            int c = read_char();
-            if (c == EOF) {
-                throw parse_error("reached the end of the stream while parsing escseq", ParseError::EndOfStream);
-            }
-            append_symbol(str, c);
+    // moves a borrowed slice to the end of the scratch buffer, so characters that are not adjacent in the input can be appended to it
+    void spill(Slice& slice) {
+        if (slice.copied)
+            return;
+        slice.offset = scratch.size();
+        if (slice.size > 0)
+            scratch.append(slice.data, slice.size);
+        slice.copied = true;
+    }
 
-            i++;
-            if (c == ';') {
-                break;
+    // appends characters from the input to a slice, which extends a borrowed slice without copying if they are adjacent
+    void append_span(Slice& slice, const char* span, size_t len) {
+        if constexpr (Reader::stable) {
+            if (!slice.copied) {
+                if (slice.size == 0) {
+                    slice.data = span;
+                    slice.size = len;
+                    return;
+                }
+                if (slice.data + slice.size == span) {
+                    slice.size += len;
+                    return;
+                }
+                if constexpr (Reader::in_place) {
+                    // shift the characters back over the markup or escape that separated them from the slice
+                    std::memmove(const_cast<char*>(slice.data) + slice.size, span, len);
+                    slice.size += len;
+                    return;
+                }
             }
         }
-        std::string_view view(str.data() + str.size() - i, i);
+        spill(slice);
+        scratch.append(span, len);
+        slice.size += len;
+    }
 
-        char escch;
-        if (view == "&quot;")
-            escch = '"';
-        else if (view == "&apos;")
-            escch = '\'';
-        else if (view == "&lt;")
-            escch = '<';
-        else if (view == "&gt;")
-            escch = '>';
-        else if (view == "&amp;")
-            escch = '&';
-        else
-            throw parse_error("encountered invalid esc sequence: '" + str + "'", ParseError::InvalidEscSeq);
+    // appends a character that does not appear in the input (such as a decoded escape), which requires the slice be copied
+    void append_symbol(Slice& slice, i64 c) {
+        spill(slice);
+        scratch += static_cast<char>(c);
+        slice.size += 1;
+    }
+
+    // appends the peeked character c to the slice and consumes it
+    void take_char(Slice& slice, i64 c) {
+        if constexpr (Reader::stable) {
+            auto position = cursor();
+            read_char();
+            append_span(slice, position, 1);
+        }
+        else {
+            read_char();
+            append_symbol(slice, c);
+        }
+    }
 
-        str.erase(str.size() - i, str.size());
-        str += escch;
+    // appends every character up to the next delimiter (or the end of the block) to the slice at once
+    template <char... Delims>
+    void read_run(Slice& slice) {
+        if (!sync_block())
+            return;
+
+        auto block = reader.block();
+        auto begin = block.data();
+        auto end = scan_delims<Delims...>(begin, begin + block.size());
+
+        auto len = static_cast<size_t>(end - begin);
+        if (len > 0) {
+            append_span(slice, begin, len);
+            consume_run(len);
+        }
     }
 
-    static void trim_spaces(std::string& str) {
-        int size = static_cast<int>(str.size());
-        int i = size - 1;
-        while (i >= 0) {
-            if (!std::isspace(str[i])) {
-                break;
+    bool read_escseq(Slice& slice) {
+        const char* source = nullptr;
+        std::string_view seq;
+        std::string seq_chars;
+
+        if constexpr (Reader::contiguous) {
+            // the escape is decoded where it lies in the input, without copying it out first
+            source = cursor();
+            size_t remaining = reader.size - reader.position;
+            auto end = static_cast<const char*>(std::memchr(source, ';', remaining));
+            if (end == nullptr) {
+                consume_run(remaining);
+                return fail("reached the end of the stream while parsing escseq", ParseError::EndOfStream);
             }
-            i -= 1;
+            seq = std::string_view(source, end + 1 - source);
+            consume_run(seq.size());
         }
-        if (i < size) {
-            str.erase(i + 1);
+        else {
+            while (true) {
+                i64 c = read_char();
+                if (c == EOF) {
+                    return fail("reached the end of the stream while parsing escseq", ParseError::EndOfStream);
+                }
+                seq_chars += static_cast<char>(c);
+
+                if (c == ';') {
+                    break;
+                }
+            }
+            seq = seq_chars;
+        }
+
+        char decoded[4];
+        size_t len = decode_escseq(seq, decoded);
+        if (len == 0)
+            return fail("encountered invalid esc sequence: '" + std::string(view(slice)) + std::string(seq) + "'", ParseError::InvalidEscSeq);
+
+        if constexpr (Reader::in_place) {
+            // the decoded characters are never longer than their escape, so they always fit over the characters that were already read
+            if (slice.size == 0)
+                slice.data = source;
+            std::memcpy(const_cast<char*>(slice.data) + slice.size, decoded, len);
+            slice.size += len;
         }
+        else {
+            for (size_t i = 0; i < len; i++)
+                append_symbol(slice, decoded[i]);
+        }
+        return true;
+    }
+
+    void trim_spaces(Slice& slice) {
+        auto str = view(slice);
+        size_t size = str.size();
+        while (size > 0 && is_space(str[size - 1])) {
+            size -= 1;
+        }
+        if (slice.copied) {
+            scratch.resize(slice.offset + size);
+        }
+        slice.size = size;
     }
 
-    Text read_rawtext() {
+    bool read_rawtext(Slice& text) {
         skip_spaces();
 
-        std::string str;
+        bool empty = true;
         while (true) {
+            // plain text is read in bulk, so the character by character path below only handles markup and escapes
+            read_run<'<', '&'>(text);
+
             i64 c = peek_char();
             if (c == EOF) {
-                throw parse_error("reached the end of the stream while parsing raw data", ParseError::EndOfStream);
+                return fail("reached the end of the stream while parsing raw data", ParseError::EndOfStream);
             }
 
             if (c == '&') {
-                read_escseq(str);
+                if (!read_escseq(text))
+                    return false;
             }
             else if (c == '<') {
                 if (read_match("<![CDATA[")) {
-                    read_cdata(str);
+                    if (!read_cdata(text))
+                        return false;
+                }
+                else if (empty && text.size == 0) {
+                    // a markup declaration that is not a comment, doctype or cdata would otherwise be read as an empty text forever
+                    return fail("expected text, <open-tag> or <open-comment> symbol, got <!", ParseError::InvalidOpenTok);
                 }
                 else {
                     break;
                 }
             }
             else {
-                append_symbol(str, c);
-                read_char();
+                take_char(text, c);
             }
+            empty = false;
         }
 
-        trim_spaces(str);
-        str.shrink_to_fit();
-        return Text(std::move(str));
+        trim_spaces(text);
+        return true;
     }
 
-    void read_cdata(std::string& str) {
+    bool read_cdata(Slice& str) {
         while (true) {
-            i64 c = read_char();
+            read_run<']'>(str);
+
+            i64 c = peek_char();
             if (c == EOF) {
-                throw parse_error("reached the end of the stream while parsing cdata", ParseError::EndOfStream);
+                return fail("reached the end of the stream while parsing cdata", ParseError::EndOfStream);
             }
 
             // check for a closing cdata tag
-            if (c == ']') {
-                i64 c1 = read_char();
-                if (c1 == EOF) {
-                    throw parse_error("reached the end of the stream while parsing cdata close tag", ParseError::EndOfStream);
-                }
-
-                i64 c2 = read_char();
-                if (c2 == EOF) {
-                    throw parse_error("reached the end of the stream while parsing cdata close tag", ParseError::EndOfStream);
-                }
+            if (c == ']' && read_match("]]>")) {
+                return true;
+            }
 
-                if (c1 == ']' && c2 == '>')
-                    break;
+            take_char(str, c);
+        }
+    }
 
-                append_symbol(str, c1);
-                append_symbol(str, c2);
-            }
-            append_symbol(str, c);
+    // appends the next len characters to the slice and consumes them, which must have been peeked
+    void take_chars(Slice& slice, size_t len) {
+        if constexpr (Reader::stable) {
+            auto position = cursor();
+            consume(len);
+            append_span(slice, position, len);
+        }
+        else {
+            for (size_t i = 0; i < len; i++)
+                append_symbol(slice, read_char());
         }
     }
 
-    // non unicode compliant character detection
-    bool static is_name_start(i64 c) {
-        return isalpha(static_cast<char>(c)) || c == ':' || c == '_';
+    // takes the peeked name character c, or the utf-8 sequence it begins, returns false without consuming anything if it is not one
+    bool take_name_char(Slice& slice, i64 c, bool start) {
+        auto lead = static_cast<unsigned char>(c);
+        auto char_class = CHAR_CLASSES[lead];
+        if ((char_class & MULTI_BYTE_CHAR) == 0) {
+            if ((char_class & (start ? NAME_START_CHAR : NAME_CHAR)) == 0)
+                return false;
+            take_char(slice, c);
+            return true;
+        }
+
+        size_t len = utf8_length(lead);
+        if (len == 0)
+            return false;
+
+        unsigned char seq[4] = {lead};
+        for (size_t i = 1; i < len; i++) {
+            i64 next = peek_ahead(static_cast<int>(i));
+            if (next == EOF)
+                return false;
+            seq[i] = static_cast<unsigned char>(next);
+        }
+
+        uint32_t code_point;
+        if (!decode_utf8(seq, len, code_point))
+            return false;
+        if (start ? !is_name_start_code_point(code_point) : !is_name_code_point(code_point))
+            return false;
+
+        take_chars(slice, len);
+        return true;
     }
 
-    bool static is_name(i64 c) {
-        return is_name_start(c) || isdigit(static_cast<char>(c)) || c == '-' || c == '.';
+    // takes the run of single byte name characters at the cursor at once, which only contiguous readers can scan ahead for
+    void take_name_run(Slice& str, bool& start) {
+        if constexpr (Reader::contiguous) {
+            auto begin = cursor();
+            auto len = static_cast<size_t>(scan_name(begin, reader.data + reader.size, start) - begin);
+            if (len > 0) {
+                append_span(str, begin, len);
+                consume_run(len);
+                start = false;
+            }
+        }
     }
 
-    void read_tagname(std::string& str) {
-        int i = 0;
+    bool read_tagname(Slice& str) {
+        bool start = true;
         while (true) {
+            take_name_run(str, start);
+
             i64 c = peek_char();
             if (c == EOF) {
-                break;
+                return true;
             }
 
             if (c == ' ' || c == '>' || c == '?' || c == '/') {
-                break;
-            }
-            if ((i == 0 && is_name_start(c)) || (i > 0 && is_name(c))) {
-                append_symbol(str, c);
-                read_char();
+                return true;
             }
-            else {
-                throw parse_error("invalid character in tag name: " + char_string(c), ParseError::InvalidTagname);
+            if (!take_name_char(str, c, start)) {
+                return fail("invalid character in tag name: " + char_string(c), ParseError::InvalidTagname);
             }
-            i += 1;
+            start = false;
         }
-         str.shrink_to_fit();
     }
 
-    void read_attrvalue(std::string& str) {
+    bool read_attrvalue(Slice& str) {
         auto open_symbol = read_char();
         if (open_symbol != '"' && open_symbol != '\'') {
-            throw parse_error("attr val must begin with single or double quotes, found: " + char_string(open_symbol), ParseError::AttrValBegin);
+            return fail("attr val must begin with single or double quotes, found: " + char_string(open_symbol), ParseError::AttrValBegin);
         }
         auto close_symbol = open_symbol;
 
         while (true) {
             i64 c = peek_char();
             if (c == EOF) {
-                break;
+                return true;
             }
 
             if (c == '&') {
-                read_escseq(str);
+                if (!read_escseq(str))
+                    return false;
             }
-            else {
+            else if (c == close_symbol) {
                 read_char();
-                if (c == close_symbol) {
-                    break;
-                }
-                append_symbol(str, c);
+                return true;
+            }
+            else {
+                take_char(str, c);
             }
         }
-         str.shrink_to_fit();
     }
 
-    void read_attrname(std::string& str) {
+    // unlike a tag name, an attr name is not checked to begin with a name start character
+    void read_attrname(Slice& str) {
+        bool start = false;
         while (true) {
+            take_name_run(str, start);
+
             i64 c = peek_char();
             if (c == EOF) {
                 break;
             }
-            if (!is_name(c)) {
+            if (!take_name_char(str, c, false)) {
                 break;
             }
-            append_symbol(str, c);
-            read_char();
         }
-         str.shrink_to_fit();
     }
 
     enum token {
@@ -373,7 +994,8 @@ struct Parser {
         close_end = 6,
         open_dtd = 7,
         text_tok = 8,
-        eof_tok = 9
+        eof_tok = 9,
+        error_tok = 10 // the parser failed while reading the token
     };
 
     token read_open_tok() {
@@ -451,560 +1073,2656 @@ struct Parser {
             read_char();
             return close_end;
         case '<':
-            throw parse_error("expected close token: <close-decl>, or <close-tag>, got: " + char_string(c), ParseError::InvalidCloseTok);
+            fail("expected close token: <close-decl>, or <close-tag>, got: " + char_string(c), ParseError::InvalidCloseTok);
+            return error_tok;
         default:
             return text_tok;
         }
     }
 
-    token parse_attrs(std::vector<Attr>& attrs) {
+    // reads the attr list of a tag into attrs, which are only resolved to views once the list is closed since the scratch buffer may grow
+    token parse_attrs() {
+        attr_slices.clear();
         while (true) {
-            Attr attr;
-
             auto tok = read_close_tok();
             switch (tok) {
             case eof_tok:
-                throw parse_error("reached end of stream while parsing attrs", ParseError::EndOfStream);
+                fail("reached end of stream while parsing attrs", ParseError::EndOfStream);
+                return error_tok;
+            case error_tok:
+                return error_tok;
             case close_end:
             case close_beg:
             case close_decl:
-                 attrs.shrink_to_fit();
                 // no more attrs in the attr list to parse
+                attrs.clear();
+                for (auto& [name, value]: attr_slices)
+                    attrs.emplace_back(view(name), view(value));
                 return tok;
             case text_tok:
-                read_attrname(attr.name);
                 break;
             default:
                 // this branch should never be called
                 auto m = "expected an attribute name, <close-tag>, or <close-decl> symbols, got " + std::to_string(tok);
-                throw parse_error(m, ParseError::InvalidAttrList);
+                fail(m, ParseError::InvalidAttrList);
+                return error_tok;
             }
 
+            Slice name;
+            read_attrname(name);
+
             i64 c = read_char();
             if (c == EOF) {
-                throw parse_error("reached end of stream while parsing attrs", ParseError::EndOfStream);
+                fail("reached end of stream while parsing attrs", ParseError::EndOfStream);
+                return error_tok;
             }
             if (c != '=') {
-                throw parse_error("expected an <equals> symbol between attribute pairs, got " + char_string(c), ParseError::InvalidAttrList);
+                fail("expected an <equals> symbol between attribute pairs, got " + char_string(c), ParseError::InvalidAttrList);
+                return error_tok;
             }
 
-            read_attrvalue(attr.value);
-            attrs.push_back(std::move(attr));
+            Slice value;
+            if (!read_attrvalue(value))
+                return error_tok;
+            attr_slices.emplace_back(name, value);
         }
     }
 
-    Elem parse_elem_tree() {
-        std::stack<Elem*> stack;
-
-        // Start by parsing the root elem node
-        Elem root;
-
-        read_tagname(root.tag);
-        auto close_tok = parse_attrs(root.attrs);
+    void push_tag(std::string_view tag) {
+        if constexpr (Reader::stable) {
+            open_tags.push_back(tag);
+        }
+        else {
+            open_tag_names += tag;
+            open_tag_ends.push_back(open_tag_names.size());
+        }
+    }
 
-        switch (close_tok) {
-        case close_end:
-            stack.push(&root);
-            break;
-        case close_beg:
-            // The root has no child_nodes
-            return root;
-        default:
-            throw parse_error("unclosed attrs list in tag", ParseError::UnclosedAttrsList);
+    std::string_view top_tag() const {
+        if constexpr (Reader::stable) {
+            return open_tags.back();
+        }
+        else {
+            size_t begin = open_tag_ends.size() > 1 ? open_tag_ends[open_tag_ends.size() - 2] : 0;
+            return std::string_view(open_tag_names).substr(begin, open_tag_ends.back() - begin);
         }
+    }
 
-        std::string actual_tag;
+    void pop_tag() {
+        if constexpr (Reader::stable) {
+            open_tags.pop_back();
+        }
+        else {
+            open_tag_ends.pop_back();
+            open_tag_names.resize(open_tag_ends.empty() ? 0 : open_tag_ends.back());
+        }
+    }
 
-        // Parse until the stack is empty using tokens to decide when to push/pop
-        while (!stack.empty()) {
-            Elem* top = stack.top();
+    size_t depth() const {
+        if constexpr (Reader::stable)
+            return open_tags.size();
+        else
+            return open_tag_ends.size();
+    }
 
-            token tok = read_open_tok();
-            switch (tok) {
-            case eof_tok:
-                throw parse_error("reached end of stream while parsing element children", ParseError::EndOfStream);
-            case open_end: {
-                read_tagname(actual_tag);
-
-                if (actual_tag != top->tag) {
-                    std::string m("expected a closing tag to be '");
-                    m += top->tag;
-                    m += "' symbol, got '";
-                    m += actual_tag;
-                    m += "'";
-                    throw parse_error(m, ParseError::CloseTagMismatch);
-                }
-                actual_tag.clear();
+    // reads the tag and attrs of an elem whose open symbol was consumed, an elem with children stays open until its end tag
+    template <class Handler>
+    bool parse_elem(Handler& handler, ParseError unclosed_code) {
+        Slice tag;
+        if (!read_tagname(tag))
+            return false;
+        auto close_tok = parse_attrs();
 
-                token tok1 = read_close_tok();
-                if (tok1 == eof_tok) {
-                    throw parse_error("reached end of stream while parsing an end tag", ParseError::EndOfStream);
-                }
-                if (tok1 != close_end) {
-                    throw parse_error("expected a <close-tag> symbol, got " + std::to_string(tok), ParseError::InvalidCloseTok);
-                }
+        if (close_tok == error_tok) {
+            return false;
+        }
+        if (close_tok != close_end && close_tok != close_beg) {
+            return fail("unclosed attrs list in tag", unclosed_code);
+        }
 
-                // Reaching the end of this node means we backtrack
-                top->children.shrink_to_fit();
-                stack.pop();
-                break;
-            }
-            case open_cmt: {
-                auto cmnt = parse_cmnt();
-                top->add_node(std::move(cmnt));
-                break;
-            }
-            case open_beg: {
-                // Read the next element to be processed by the parser
-                auto elem = std::make_unique<Elem>(Elem());
-                auto elem_ptr = elem.get();
+        auto tag_view = view(tag);
+        handler.on_open(tag_view, attrs);
+        if (close_tok == close_end) {
+            push_tag(tag_view);
+        }
+        else {
+            // close_beg means the elem has no children
+            handler.on_close(tag_view);
+        }
+        return true;
+    }
 
-                read_tagname(elem_ptr->tag);
-                close_tok = parse_attrs(elem_ptr->attrs);
+    template <class Handler>
+    bool parse_end_tag(Handler& handler) {
+        Slice tag;
+        if (!read_tagname(tag))
+            return false;
 
-                if (close_tok == close_end) {
-                    // This will be the next elem we parse
-                    stack.push(elem_ptr);
-                }
-                else if (close_tok != close_beg) { // close_beg means the elem has no children
-                    throw parse_error("unclosed attrs list in tag", ParseError::InvalidAttrList);
-                }
+        // a fragment may close elems that were opened before it began, which are only matched once the fragments are joined
+        auto actual_tag = view(tag);
+        if (depth() > 0 && actual_tag != top_tag()) {
+            std::string m("expected a closing tag to be '");
+            m += top_tag();
+            m += "' symbol, got '";
+            m += actual_tag;
+            m += "'";
+            return fail(m, ParseError::CloseTagMismatch);
+        }
 
-                top->add_node(std::move(elem));
-                break;
-            }
-            case text_tok: {
-                auto text = read_rawtext();
-                top->add_node(std::move(text));
-                break;
-            }
-            default:
-                auto m = "expected tex, <open-tag> or <open-comment> symbol, got " + std::to_string(tok);
-                throw parse_error(m, ParseError::InvalidOpenTok);
-            }
+        token tok = read_close_tok();
+        if (tok == error_tok) {
+            return false;
+        }
+        if (tok == eof_tok) {
+            return fail("reached end of stream while parsing an end tag", ParseError::EndOfStream);
+        }
+        if (tok != close_end) {
+            return fail("expected a <close-tag> symbol, got " + std::to_string(tok), ParseError::InvalidCloseTok);
         }
 
-        return root;
+        // Reaching the end of this node means we backtrack
+        handler.on_close(actual_tag);
+        if (depth() > 0)
+            pop_tag();
+        return true;
     }
 
-    Cmnt parse_cmnt() {
+    template <class Handler>
+    bool parse_cmnt(Handler& handler) {
         skip_spaces();
-        Cmnt cmnt;
+        Slice cmnt;
 
         while (true) {
+            read_run<'-'>(cmnt);
+
             // check if there are more chars to read
             i64 c = peek_char();
             if (c == EOF) {
-                throw parse_error("reached end of stream while parsing comment", ParseError::EndOfStream);
+                return fail("reached end of stream while parsing comment", ParseError::EndOfStream);
             }
             // check for a closing comment tag
             if (read_match("-->")) {
-                trim_spaces(cmnt.data);
-                return cmnt;
+                trim_spaces(cmnt);
+                handler.on_cmnt(view(cmnt));
+                return true;
             }
 
-            append_symbol(cmnt.data, c);
-            read_char();
+            take_char(cmnt, c);
         }
     }
 
-    Decl parse_decl() {
-        Decl decl;
-        read_tagname(decl.tag);
+    const AttrView* select_attr(std::string_view attr_name) const {
+        for (auto& attr: attrs)
+            if (attr.name == attr_name)
+                return &attr;
+        return nullptr;
+    }
+
+    template <class Handler>
+    bool parse_decl(Handler& handler) {
+        Slice tag;
+        if (!read_tagname(tag))
+            return false;
 
-        token tok = parse_attrs(decl.attrs);
+        token tok = parse_attrs();
+        if (tok == error_tok) {
+            return false;
+        }
         if (tok != close_decl) {
-            throw parse_error("expected <close-decl> symbol to close a decl, got " + std::to_string(tok), ParseError::InvalidCloseDecl);
+            return fail("expected <close-decl> symbol to close a decl, got " + std::to_string(tok), ParseError::InvalidCloseDecl);
+        }
+
+        auto tag_view = view(tag);
+        if (tag_view == "xml") {
+            if (parsed_meta)
+                return fail("document may only have a single xml meta decl tag", ParseError::InvalidXmlMeta);
+
+            auto vattr = select_attr("version");
+            if (vattr == nullptr)
+                return fail("expected xml meta tag to have a version field", ParseError::InvalidXmlMeta);
+            if (vattr->value != "1.0")
+                return fail("only supports parsing documents with version 1.0, got " + std::string(vattr->value), ParseError::InvalidXmlMeta);
+
+            auto eattr = select_attr("encoding");
+            if (eattr == nullptr)
+                return fail("expected xml meta tag to have an encoding field", ParseError::InvalidXmlMeta);
+            if (eattr->value != "UTF-8")
+                return fail("only supports UTF-8 encodings, got " + std::string(eattr->value), ParseError::InvalidXmlMeta);
+
+            parsed_meta = true;
         }
 
-        return decl;
+        handler.on_decl(tag_view, attrs);
+        return true;
     }
 
-    Dtd parse_dtd() {
+    template <class Handler>
+    bool parse_dtd(Handler& handler) {
         skip_spaces();
-        Dtd dtd;
+        Slice dtd;
 
         while (true) {
-            i64 c = read_char();
+            read_run<'>'>(dtd);
+
+            i64 c = peek_char();
             if (c == EOF) {
-                throw parse_error("reached end of stream while parsing a doctype", ParseError::EndOfStream);
+                return fail("reached end of stream while parsing a doctype", ParseError::EndOfStream);
             }
 
             if (c == '>') {
-                trim_spaces(dtd.data);
-                return dtd;
+                read_char();
+                trim_spaces(dtd);
+                handler.on_dtd(view(dtd));
+                return true;
             }
-            append_symbol(dtd.data, c);
+            take_char(dtd, c);
         }
     }
 
-    void parse(Document& document) {
-        bool parsed_root = false;
-        bool parsed_meta = false;
-
-        while (true) {
-            token tok = read_open_tok();
-            switch (tok) {
-            case eof_tok:
-                return;
-            case open_dtd: {
-                auto dtd = parse_dtd();
-                document.children.emplace_back(std::move(dtd));
-                break;
+    // parses the next node outside the root elem, returns false once the end of the document has been reached or the parser failed
+    template <class Handler>
+    bool step_document(Handler& handler) {
+        token tok = read_open_tok();
+        switch (tok) {
+        case eof_tok:
+            return false;
+        case open_dtd:
+            return parse_dtd(handler);
+        case open_decl:
+            return parse_decl(handler);
+        case open_cmt:
+            return parse_cmnt(handler);
+        case open_beg:
+            if (parsed_root) {
+                return fail("expected an xml document to only have a single root node", ParseError::MultipleRoots);
             }
-            case open_decl: {
-                auto decl = parse_decl();
+            if (!parse_elem(handler, ParseError::UnclosedAttrsList))
+                return false;
+            parsed_root = true;
+            return true;
+        default:
+            auto m = "expected data or a <open-tag>, <open-dtd>, <open-comment> or <open-decl> symbol, got " + std::to_string(tok);
+            return fail(m, ParseError::InvalidRootOpenTok);
+        }
+    }
+
+    // parses the next child node of the innermost open elem, returns false if the parser failed
+    template <class Handler>
+    bool step_elem(Handler& handler) {
+        token tok = read_open_tok();
+        switch (tok) {
+        case eof_tok:
+            return fail("reached end of stream while parsing element children", ParseError::EndOfStream);
+        case open_end:
+            return parse_end_tag(handler);
+        case open_cmt:
+            return parse_cmnt(handler);
+        case open_beg:
+            // Read the next element to be processed by the parser
+            return parse_elem(handler, ParseError::InvalidAttrList);
+        case text_tok: {
+            Slice text;
+            if (!read_rawtext(text))
+                return false;
+            handler.on_text(view(text));
+            return true;
+        }
+        default:
+            auto m = "expected tex, <open-tag> or <open-comment> symbol, got " + std::to_string(tok);
+            return fail(m, ParseError::InvalidOpenTok);
+        }
+    }
+
+    // parses the next node of a fragment of elem content that starts at a node boundary, returns false at the end of the fragment
+    // unlike step_elem the fragment may end with elems left open and may close elems it did not open
+    template <class Handler>
+    bool try_step_fragment(Handler& handler) {
+        scratch.clear();
+        token tok = read_open_tok();
+        switch (tok) {
+        case eof_tok:
+            return false;
+        case open_end:
+            return parse_end_tag(handler);
+        case open_cmt:
+            return parse_cmnt(handler);
+        case open_beg:
+            return parse_elem(handler, ParseError::InvalidAttrList);
+        case text_tok: {
+            Slice text;
+            if (!read_rawtext(text))
+                return false;
+            handler.on_text(view(text));
+            return true;
+        }
+        default:
+            auto m = "expected tex, <open-tag> or <open-comment> symbol, got " + std::to_string(tok);
+            return fail(m, ParseError::InvalidOpenTok);
+        }
+    }
 
-                if (decl.tag == "xml") {
-                    if (parsed_meta)
-                        throw parse_error("document may only have a single xml meta decl tag", ParseError::InvalidXmlMeta);
+    // parses a single node and emits it to the handler, returns false once the end of the document has been reached
+    // a malformed document also returns false, with failed set and the error in failure rather than thrown
+    template <class Handler>
+    bool try_step(Handler& handler) {
+        scratch.clear();
+        if (depth() == 0)
+            return step_document(handler);
+        return step_elem(handler);
+    }
 
-                    auto vattr = decl.select_attr("version");
-                    if (vattr == nullptr)
-                        throw parse_error("expected xml meta tag to have a version field", ParseError::InvalidXmlMeta);
-                    if (vattr->value != "1.0")
-                        throw parse_error("only supports parsing documents with version 1.0, got " + vattr->value, ParseError::InvalidXmlMeta);
+    // parses the rest of the document, returns false if it is malformed
+    template <class Handler>
+    bool try_parse(Handler& handler) {
+        while (try_step(handler));
+        return !failed;
+    }
 
-                    auto eattr = decl.select_attr("encoding");
-                    if (eattr == nullptr)
-                        throw parse_error("expected xml meta tag to have an encoding field", ParseError::InvalidXmlMeta);
-                    if (eattr->value != "UTF-8")
-                        throw parse_error("only supports UTF-8 encodings, got " + eattr->value, ParseError::InvalidXmlMeta);
+    // throws the recorded failure, which is cleared first since the push parser steps again once it has more input
+    void throw_failure() {
+        failed = false;
+        throw parse_exception();
+    }
 
-                    parsed_meta = true;
-                }
+    template <class Handler>
+    bool step_fragment(Handler& handler) {
+        bool stepped = try_step_fragment(handler);
+        if (failed)
+            throw_failure();
+        return stepped;
+    }
 
-                document.children.emplace_back(std::move(decl));
-                break;
-            }
-            case open_cmt: {
-                auto cmnt = parse_cmnt();
-                document.children.emplace_back(std::move(cmnt));
-                break;
+    template <class Handler>
+    bool step(Handler& handler) {
+        bool stepped = try_step(handler);
+        if (failed)
+            throw_failure();
+        return stepped;
+    }
+
+    template <class Handler>
+    void parse(Handler& handler) {
+        while (step(handler));
+    }
+};
+
+// counts the children of every elem in the order the elems are opened, so that a document builder can reserve them up front
+// only the markup that delimits nodes is scanned, the names, attrs and escapes are left to the parse to read and check
+static std::vector<size_t> count_children(const char* buffer, size_t size) {
+    std::vector<size_t> counts; // the children count of each elem, in document order
+    std::vector<size_t> stack; // the indices into counts of the open elems
+    std::string_view data(buffer, size);
+    bool in_text = false; // set while a text is scanned, which continues through cdata sections as it does in the parser
+
+    auto add_child = [&]() {
+        if (!stack.empty())
+            counts[stack.back()]++;
+    };
+    // the position after the first closing markup from pos, the end of the input if there is none
+    auto skip_past = [&](size_t pos, std::string_view close) {
+        auto found = data.find(close, pos);
+        return found == std::string_view::npos ? data.size() : found + close.size();
+    };
+
+    size_t i = 0;
+    while (i < data.size()) {
+        if (data[i] != '<') {
+            auto next = std::min(data.find('<', i), data.size());
+            if (!in_text && std::any_of(data.begin() + i, data.begin() + next, [](char c) { return !is_space(c); })) {
+                add_child();
+                in_text = true;
             }
-            case open_beg: {
-                if (parsed_root) {
-                    throw parse_error("expected an xml document to only have a single root node", ParseError::MultipleRoots);
-                }
-                auto elem = parse_elem_tree();
-                document.add_root(std::move(elem));
-                parsed_root = true;
+            i = next;
+            continue;
+        }
+
+        auto rest = data.substr(i);
+        if (rest.starts_with("<![CDATA[")) {
+            if (!in_text)
+                add_child();
+            in_text = true;
+            i = skip_past(i + 9, "]]>");
+            continue;
+        }
+
+        in_text = false;
+        if (rest.starts_with("<!--")) {
+            add_child();
+            i = skip_past(i + 4, "-->");
+        }
+        else if (rest.starts_with("<?")) {
+            i = skip_past(i + 2, "?>");
+        }
+        else if (rest.starts_with("<!")) {
+            i = skip_past(i + 2, ">");
+        }
+        else if (rest.starts_with("</")) {
+            if (!stack.empty())
+                stack.pop_back();
+            i = skip_past(i + 2, ">");
+        }
+        else {
+            add_child();
+            stack.push_back(counts.size());
+            counts.push_back(0);
+
+            // the tag ends at the first '>' outside of its attr values
+            i = data.find_first_of("\"'>", i + 1);
+            while (i != std::string_view::npos && data[i] != '>')
+                i = data.find_first_of("\"'>", skip_past(i + 1, data.substr(i, 1)));
+            if (i == std::string_view::npos)
                 break;
-            }
-            default:
-                auto m = "expected data or a <open-tag>, <open-dtd>, <open-comment> or <open-decl> symbol, got " + std::to_string(tok);
-                throw parse_error(m, ParseError::InvalidRootOpenTok);
+            if (data[i - 1] == '/')
+                stack.pop_back();
+            i++;
+        }
+    }
+    return counts;
+}
+
+// builds an owning document from the events of a parser
+struct DocumentBuilder {
+    Document& document;
+    std::vector<Elem*> stack;
+    const std::vector<size_t>* children_counts = nullptr; // reserved for each opened elem if present, counted by a pre-scan
+    size_t elems_count = 0;
+
+    explicit DocumentBuilder(Document& document) : document(document) {}
+
+    DocumentBuilder(Document& document, const std::vector<size_t>& children_counts)
+        : document(document), children_counts(&children_counts) {}
+
+    void on_open(std::string_view tag, const std::vector<AttrView>& attrs) {
+        auto elem = std::make_unique<Elem>(std::string(tag));
+        if (children_counts != nullptr && elems_count < children_counts->size())
+            elem->children.reserve((*children_counts)[elems_count]);
+        elems_count++;
+        elem->attrs.reserve(attrs.size());
+        for (auto& attr: attrs)
+            elem->attrs.emplace_back(std::string(attr.name), std::string(attr.value));
+
+        auto elem_ptr = elem.get();
+        if (stack.empty())
+            document.root = std::move(elem);
+        else
+            stack.back()->children.emplace_back(std::move(elem));
+        stack.push_back(elem_ptr);
+    }
+
+    void on_close(std::string_view) {
+        stack.pop_back();
+    }
+
+    void on_text(std::string_view data) {
+        stack.back()->children.emplace_back(Text(std::string(data)));
+    }
+
+    void on_cmnt(std::string_view data) {
+        if (stack.empty())
+            document.children.emplace_back(Cmnt(std::string(data)));
+        else
+            stack.back()->children.emplace_back(Cmnt(std::string(data)));
+    }
+
+    void on_decl(std::string_view tag, const std::vector<AttrView>& attrs) {
+        Decl decl{std::string(tag), {}};
+        decl.attrs.reserve(attrs.size());
+        for (auto& attr: attrs)
+            decl.attrs.emplace_back(std::string(attr.name), std::string(attr.value));
+        document.children.emplace_back(std::move(decl));
+    }
+
+    void on_dtd(std::string_view data) {
+        document.children.emplace_back(Dtd(std::string(data)));
+    }
+};
+
+// returns the string if it points into the input, otherwise a copy of it allocated from the arena
+static std::string_view keep_string(Arena& arena, const char* input_begin, const char* input_end, std::string_view str) {
+    auto data = str.data();
+    if (str.empty() || (std::less_equal<const char*>()(input_begin, data) && std::less_equal<const char*>()(data + str.size(), input_end)))
+        return str;
+
+    auto copy = static_cast<char*>(arena.allocate(str.size(), 1));
+    std::memcpy(copy, data, str.size());
+    return {copy, str.size()};
+}
+
+// the ids of the symbol table are stored in blocks that are never moved, so a name can be looked up by id without a lock
+struct SymbolStore {
+    static constexpr size_t SHARDS_COUNT = 64; // names are spread over independently locked maps to reduce contention
+    static constexpr size_t BLOCK_SIZ = 4096;
+    static constexpr size_t MAX_BLOCKS = 1 << 16;
+    static constexpr size_t CHARS_BLOCK_SIZ = 64 * 1024;
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<std::string_view, uint32_t> ids; // keyed by the interned names
+    };
+
+    Shard shards[SHARDS_COUNT];
+    std::atomic<std::string_view*> blocks[MAX_BLOCKS] = {};
+    std::atomic<uint32_t> count = 1;
+
+    std::mutex chars_mutex; // guards the allocation of ids and of the characters of names
+    std::vector<std::unique_ptr<char[]>> chars_blocks;
+    char* chars_next = nullptr;
+    size_t chars_left = 0;
+
+    SymbolStore() {
+        blocks[0].store(new std::string_view[BLOCK_SIZ]);
+    }
+
+    ~SymbolStore() {
+        for (auto& block: blocks)
+            delete[] block.load();
+    }
+
+    static SymbolStore& instance() {
+        static SymbolStore store;
+        return store;
+    }
+
+    Shard& shard(std::string_view name) {
+        return shards[std::hash<std::string_view>()(name) % SHARDS_COUNT];
+    }
+
+    uint32_t add(std::string_view name) {
+        std::lock_guard lock(chars_mutex);
+
+        auto id = count.load(std::memory_order_relaxed);
+        if (id / BLOCK_SIZ >= MAX_BLOCKS)
+            throw std::length_error("symbol table is full");
+
+        if (name.size() > chars_left) {
+            chars_left = std::max(name.size(), CHARS_BLOCK_SIZ);
+            chars_blocks.emplace_back(new char[chars_left]);
+            chars_next = chars_blocks.back().get();
+        }
+        auto chars = chars_next;
+        std::memcpy(chars, name.data(), name.size());
+        chars_next += name.size();
+        chars_left -= name.size();
+
+        auto& block = blocks[id / BLOCK_SIZ];
+        if (block.load(std::memory_order_relaxed) == nullptr)
+            block.store(new std::string_view[BLOCK_SIZ], std::memory_order_release);
+        block.load(std::memory_order_relaxed)[id % BLOCK_SIZ] = {chars, name.size()};
+
+        count.store(id + 1, std::memory_order_release);
+        return id;
+    }
+};
+
+Symbol SymbolTable::intern(std::string_view name) {
+    if (name.empty())
+        return {};
+
+    auto& store = SymbolStore::instance();
+    auto& shard = store.shard(name);
+    std::lock_guard lock(shard.mutex);
+
+    auto it = shard.ids.find(name);
+    if (it != shard.ids.end())
+        return {it->second};
+
+    auto id = store.add(name);
+    shard.ids.emplace(SymbolTable::name({id}), id);
+    return {id};
+}
+
+std::optional<Symbol> SymbolTable::find(std::string_view name) {
+    if (name.empty())
+        return Symbol{};
+
+    auto& shard = SymbolStore::instance().shard(name);
+    std::lock_guard lock(shard.mutex);
+
+    auto it = shard.ids.find(name);
+    if (it == shard.ids.end())
+        return std::nullopt;
+    return Symbol{it->second};
+}
+
+std::string_view SymbolTable::name(Symbol symbol) {
+    auto& store = SymbolStore::instance();
+    auto block = store.blocks[symbol.id / SymbolStore::BLOCK_SIZ].load(std::memory_order_acquire);
+    return block[symbol.id % SymbolStore::BLOCK_SIZ];
+}
+
+size_t SymbolTable::size() {
+    return SymbolStore::instance().count.load(std::memory_order_acquire);
+}
+
+std::string_view Symbol::name() const {
+    return SymbolTable::name(*this);
+}
+
+// caches the names interned during a single parse, so each distinct name only locks the shared table once per parse
+struct SymbolCache {
+    std::unordered_map<std::string_view, Symbol> symbols; // keyed by the interned names
+
+    // the symbol of the name and the name as it is stored in the table
+    std::pair<Symbol, std::string_view> intern(std::string_view name) {
+        auto it = symbols.find(name);
+        if (it == symbols.end()) {
+            auto symbol = SymbolTable::intern(name);
+            it = symbols.emplace(symbol.name(), symbol).first;
+        }
+        return {it->second, it->first};
+    }
+};
+
+// builds a borrowed document from the events of a parser, only copying the strings that do not point into the input
+// elems, their attr and child vectors, and copied strings are all allocated from the document's arena
+struct DocumentViewBuilder {
+    DocumentView& document;
+    const char* input_begin;
+    const char* input_end;
+    std::vector<ElemView*> stack;
+    std::vector<std::vector<NodeView>> levels; // the children of each open elem, copied into the arena at their exact size on close
+    SymbolCache* symbols = nullptr; // interns the tag and attr names when set
+
+    DocumentViewBuilder(DocumentView& document, const char* input, size_t size)
+        : document(document), input_begin(input), input_end(input + size) {}
+
+    std::string_view keep(std::string_view str) {
+        return keep_string(*document.arena, input_begin, input_end, str);
+    }
+
+    void on_open(std::string_view tag, const std::vector<AttrView>& attrs) {
+        std::pmr::polymorphic_allocator<ElemView> allocator(document.arena.get());
+        ElemView* elem;
+        if (symbols == nullptr) {
+            elem = allocator.new_object<ElemView>(keep(tag), document.arena.get());
+            elem->attrs.reserve(attrs.size());
+            for (auto& attr: attrs)
+                elem->attrs.emplace_back(keep(attr.name), keep(attr.value));
+        }
+        else {
+            auto [symbol, name] = symbols->intern(tag);
+            elem = allocator.new_object<ElemView>(name, document.arena.get());
+            elem->symbol = symbol;
+            elem->attrs.reserve(attrs.size());
+            for (auto& attr: attrs) {
+                auto [attr_symbol, attr_name] = symbols->intern(attr.name);
+                elem->attrs.emplace_back(attr_name, keep(attr.value), attr_symbol);
             }
         }
+
+        if (stack.empty())
+            document.root = elem;
+        else
+            levels[stack.size() - 1].emplace_back(elem);
+
+        stack.push_back(elem);
+        if (levels.size() < stack.size())
+            levels.emplace_back();
+    }
+
+    void on_close(std::string_view) {
+        auto& children = levels[stack.size() - 1];
+        stack.back()->children.assign(children.begin(), children.end());
+        children.clear();
+        stack.pop_back();
+    }
+
+    void on_text(std::string_view data) {
+        levels[stack.size() - 1].emplace_back(TextView(keep(data)));
+    }
+
+    void on_cmnt(std::string_view data) {
+        if (stack.empty())
+            document.children.emplace_back(CmntView(keep(data)));
+        else
+            levels[stack.size() - 1].emplace_back(CmntView(keep(data)));
+    }
+
+    void on_decl(std::string_view tag, const std::vector<AttrView>& attrs) {
+        DeclView decl{keep(tag), {}};
+        decl.attrs.reserve(attrs.size());
+        for (auto& attr: attrs)
+            decl.attrs.emplace_back(keep(attr.name), keep(attr.value));
+        document.children.emplace_back(std::move(decl));
+    }
+
+    void on_dtd(std::string_view data) {
+        document.children.emplace_back(DtdView(keep(data)));
     }
 };
 
-Document Document::from_file(const std::string& path) {
+Document Document::from_file(const std::string& path, CapacityPolicy policy) {
+#if MMAP_FILES
+    // parse the mapped pages directly, falling back to reading the file as a stream if it could not be mapped
+    MappedFile mapped_file(path);
+    if (mapped_file.mapped)
+        return from_buffer(mapped_file.data, mapped_file.size, policy);
+#endif
+
     std::ifstream file(path);
     if (!file.good())
         throw std::runtime_error("could not open file " + path);
 
-    return from_file(file);
+    return from_file(file, policy);
 }
 
-Document Document::from_file(std::ifstream& file) {
+Document Document::from_file(std::ifstream& file, CapacityPolicy policy) {
     Document document;
 
     StreamReader reader(file);
     Parser<StreamReader> parser(reader);
-    parser.parse(document);
+    DocumentBuilder builder(document);
+    parser.parse(builder);
 
+    if (policy == CapacityPolicy::Compact)
+        document.shrink_to_fit();
     return document;
 }
 
-Document Document::from_buffer(const char* buffer, size_t size) {
-    Document document;
+std::string ParseFailure::message() const {
+    auto position = TextPosition{}.advanced(input, input + offset);
+    return detail + " at row: " + std::to_string(position.row) + ", col: " + std::to_string(position.col);
+}
+
+ParseException ParseFailure::exception() const {
+    auto m = message();
+    return ParseException(m, code, offset);
+}
+
+// parses the buffer into the document, returns the failure rather than throwing it if the buffer is malformed
+static std::optional<ParseFailure> build_document(Document& document, const char* buffer, size_t size, CapacityPolicy policy) {
+    std::vector<size_t> children_counts;
+    if (policy == CapacityPolicy::Presize)
+        children_counts = count_children(buffer, size);
 
     StringReader reader(buffer, size);
     Parser<StringReader> parser(reader);
-    parser.parse(document);
+    DocumentBuilder builder(document, children_counts);
+    if (!parser.try_parse(builder)) {
+        parser.failure.input = buffer;
+        return std::move(parser.failure);
+    }
 
-    return document;
+    if (policy == CapacityPolicy::Compact)
+        document.shrink_to_fit();
+    return std::nullopt;
 }
 
-Document Document::from_string(const std::string& str) {
+Document Document::from_buffer(const char* buffer, size_t size, CapacityPolicy policy) {
     Document document;
-
-    StringReader reader(str.data(), str.size());
-    Parser<StringReader> parser(reader);
-    parser.parse(document);
-
+    if (auto failure = build_document(document, buffer, size, policy))
+        throw failure->exception();
     return document;
 }
 
-std::string Document::serialize() const {
-    std::ostringstream ss;
-    ss << (*this);
-    return ss.str();
+ParseResult<Document> Document::try_from_buffer(const char* buffer, size_t size, CapacityPolicy policy) {
+    Document document;
+    if (auto failure = build_document(document, buffer, size, policy))
+        return {std::move(*failure)};
+    return {std::move(document)};
 }
 
-std::string Elem::serialize() const {
-    std::ostringstream ss;
-    ss << (*this);
-    return ss.str();
+ParseResult<Document> Document::try_from_string(const std::string& str, CapacityPolicy policy) {
+    return try_from_buffer(str.data(), str.size(), policy);
 }
 
-std::string Node::serialize() const {
-    std::ostringstream ss;
-    ss << (*this);
-    return ss.str();
+Document Document::from_string(const std::string& str, CapacityPolicy policy) {
+    return from_buffer(str.data(), str.size(), policy);
 }
 
-Elem* Elem::select_elem(const std::string& ctag) {
-    for (auto& child: children)
-        if (auto elem = get_if<std::unique_ptr<Elem>>(&child.data))
-            if ((*elem)->tag == ctag)
-                return elem->get();
-    return nullptr;
-}
+// builds the nodes of a fragment of elem content, recording the closes of elems that were opened before the fragment began
+struct FragmentBuilder {
+    std::vector<Node> nodes; // the top level nodes of the fragment
+    std::vector<std::pair<size_t, std::string>> closes; // the tags closed at the top level, after how many top level nodes
+    std::vector<Elem*> stack; // the elems opened by the fragment that are still open, outermost first
 
-Attr* Elem::select_attr(const std::string& attr_name) {
-    for (auto& attr: attrs)
-        if (attr.name == attr_name)
-            return &attr;
-    return nullptr;
-}
+    void add_node(NodeVariant node) {
+        if (stack.empty())
+            nodes.emplace_back(std::move(node));
+        else
+            stack.back()->children.emplace_back(std::move(node));
+    }
 
-Elem& Elem::expect_elem(const std::string& ctag) {
-    for (auto& child: children)
-        if (auto elem = get_if<std::unique_ptr<Elem>>(&child.data))
-            if ((*elem)->tag == ctag)
-                return **elem;
-    throw NodeWalkException("elem does not contain child with tag name " + ctag);
-}
+    void on_open(std::string_view tag, const std::vector<AttrView>& attrs) {
+        auto elem = std::make_unique<Elem>(std::string(tag));
+        elem->attrs.reserve(attrs.size());
+        for (auto& attr: attrs)
+            elem->attrs.emplace_back(std::string(attr.name), std::string(attr.value));
 
-Attr& Elem::expect_attr(const std::string& attr_name) {
-    for (auto& attr: attrs)
-        if (attr.name == attr_name)
-            return attr;
-    throw NodeWalkException("elem does not contain attribute with name " + attr_name);
-}
+        auto elem_ptr = elem.get();
+        add_node(std::move(elem));
+        stack.push_back(elem_ptr);
+    }
 
-std::optional<Elem> Elem::remove_elem(const std::string& rtag) {
-    auto it = children.begin();
-    while (it != children.end()) {
-        auto& node = *it;
-        if (auto elem_ptr = std::get_if<std::unique_ptr<Elem>>(&node.data)) {
-            auto& elem = *elem_ptr;
-            if (elem->tag == rtag) {
-                auto ret = std::move(elem);
-                children.erase(it);
-                return std::move(*ret);
-            }
+    void on_close(std::string_view tag) {
+        if (stack.empty()) {
+            closes.emplace_back(nodes.size(), std::string(tag));
+            return;
         }
-        it++;
+        stack.pop_back();
     }
-    return std::nullopt;
-}
 
-std::optional<Attr> Elem::remove_attr(const std::string& name) {
-    auto it = attrs.begin();
-    while (it != attrs.end()) {
-        auto& attr = *it;
-        if (attr.name == name) {
-            auto ret = std::move(attr);
-            attrs.erase(it);
-            return ret;
-        }
-        it++;
+    void on_text(std::string_view data) {
+        add_node(Text(std::string(data)));
     }
-    return std::nullopt;
+
+    void on_cmnt(std::string_view data) {
+        add_node(Cmnt(std::string(data)));
+    }
+};
+
+// finds the start of a tag at or after pos that directly follows the end of another tag, which is likely to be a boundary between two nodes
+// the guess may land inside a comment, cdata or attr value, in which case the fragment before it fails to parse
+static const char* find_fragment_split(const char* begin, const char* pos, const char* end) {
+    while (pos < end) {
+        pos = static_cast<const char*>(std::memchr(pos, '<', end - pos));
+        if (pos == nullptr)
+            return end;
+
+        auto prev = pos;
+        while (prev > begin && is_space(prev[-1]))
+            prev--;
+        if (prev > begin && prev[-1] == '>')
+            return pos;
+        pos++;
+    }
+    return end;
 }
 
-std::optional<Decl> Document::remove_decl(const std::string& rtag) {
-    auto it = children.begin();
-    while (it != children.end()) {
-        auto& node = *it;
-        if (auto decl = std::get_if<Decl>(&node.data)) {
-            if (decl->tag == rtag) {
-                auto ret = std::move(*decl);
-                children.erase(it);
-                return ret;
+// appends the fragments in order to the open elems of the document, returns false if they do not join into a single well formed root
+static bool join_fragments(Document& document, std::vector<Elem*> stack, std::vector<FragmentBuilder>& fragments) {
+    for (auto& fragment: fragments) {
+        size_t next = 0;
+        auto append_nodes = [&](size_t count) {
+            for (; next < count; next++) {
+                auto& node = fragment.nodes[next];
+                if (!stack.empty()) {
+                    stack.back()->children.emplace_back(std::move(node));
+                    continue;
+                }
+                // only comments may follow the root
+                auto cmnt = get_if<Cmnt>(&node.data);
+                if (cmnt == nullptr)
+                    return false;
+                document.children.emplace_back(std::move(*cmnt));
             }
+            return true;
+        };
+
+        for (auto& [count, tag]: fragment.closes) {
+            if (!append_nodes(count) || stack.empty() || stack.back()->tag != tag)
+                return false;
+            stack.pop_back();
+        }
+        if (!append_nodes(fragment.nodes.size()))
+            return false;
+
+        if (!fragment.stack.empty()) {
+            if (stack.empty())
+                return false;
+            stack.insert(stack.end(), fragment.stack.begin(), fragment.stack.end());
         }
-        it++;
     }
-    return std::nullopt;
+    return stack.empty();
 }
 
-void Elem::remove_elems(const std::string& rtag) {
-    size_t back = 0;
-    for (size_t i = 0; i < children.size(); i++) {
-        Node* node_ptr = &children[i];
-
-        if (back != 0) {
-            auto index = i - back;
-            children[index] = std::move(*node_ptr);
-            node_ptr = &children[index];
+// runs fn for every index in [0, count), the first on the calling thread, and rethrows the first exception once all are done
+template <class Fn>
+static void run_on_threads(size_t count, const Fn& fn) {
+    std::vector<std::exception_ptr> errors(count);
+    auto run = [&](size_t i) {
+        try {
+            fn(i);
+        } catch (...) {
+            errors[i] = std::current_exception();
         }
+    };
 
-        if (node_ptr->is_elem() && node_ptr->as_elem().tag == rtag)
-            back++;
+    // once a thread cannot be started, the indices left are run on the calling thread after its own
+    std::vector<std::thread> threads;
+    size_t started = 1;
+    try {
+        threads.reserve(count - 1);
+        for (; started < count; started++)
+            threads.emplace_back(run, started);
+    } catch (...) {
+    }
+    run(0);
+    for (size_t i = started; i < count; i++)
+        run(i);
+    for (auto& thread: threads)
+        thread.join();
+
+    for (auto& error: errors) {
+        if (error)
+            std::rethrow_exception(error);
     }
-    children.erase(children.end() - static_cast<long long>(back), children.end());
-    children.shrink_to_fit();
 }
 
-void Elem::remove_attrs(const std::string& name) {
-    size_t back = 0;
-    for (size_t i = 0; i < attrs.size(); i++) {
-        Attr* attr_ptr = &attrs[i];
+Document Document::from_buffer_parallel(const char* buffer, size_t size, size_t thread_count, CapacityPolicy policy) {
+    // a fragment smaller than this is parsed faster than a thread can be started to parse it
+    constexpr size_t MIN_FRAGMENT_SIZ = 1 << 20;
 
-        if (back != 0) {
-            auto index = i - back;
-            attrs[index] = std::move(*attr_ptr);
-            attr_ptr = &attrs[index];
+    if (thread_count == 0)
+        thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+
+    Document document;
+
+    StringReader reader(buffer, size);
+    Parser<StringReader> parser(reader);
+    DocumentBuilder builder(document);
+
+    // the prolog and the open tag of the root are parsed in order, so that every fragment only holds elem content
+    while (!parser.parsed_root) {
+        if (!parser.step(builder))
+            return document;
+    }
+
+    auto body_begin = parser.cursor();
+    auto body_end = buffer + size;
+    size_t body_size = body_end - body_begin;
+    size_t fragments_count = std::min(thread_count, body_size / MIN_FRAGMENT_SIZ);
+    if (parser.depth() == 0 || fragments_count < 2) {
+        parser.parse(builder);
+        if (policy == CapacityPolicy::Compact)
+            document.shrink_to_fit();
+        return document;
+    }
+
+    std::vector<const char*> splits{body_begin};
+    for (size_t i = 1; i < fragments_count; i++) {
+        auto split = find_fragment_split(body_begin, body_begin + body_size / fragments_count * i, body_end);
+        if (split > splits.back() && split < body_end)
+            splits.push_back(split);
+    }
+    splits.push_back(body_end);
+
+    std::vector<FragmentBuilder> fragments(splits.size() - 1);
+    std::vector<char> failed(fragments.size(), false);
+
+    auto parse_fragment = [&](size_t i) {
+        try {
+            StringReader fragment_reader(splits[i], splits[i + 1] - splits[i]);
+            Parser<StringReader> fragment_parser(fragment_reader);
+            while (fragment_parser.try_step_fragment(fragments[i]));
+            failed[i] = fragment_parser.failed;
+        } catch (...) {
+            failed[i] = true;
         }
+    };
 
-        if (attr_ptr->name == name)
-            back++;
+    run_on_threads(fragments.size(), parse_fragment);
+
+    // a fragment that fails to parse or to join means a split was guessed wrong or the document is malformed
+    // parsing it again in order either succeeds or throws the exception with the right position
+    bool speculation_failed = std::find(failed.begin(), failed.end(), true) != failed.end();
+    if (speculation_failed || !join_fragments(document, builder.stack, fragments))
+        return from_buffer(buffer, size, policy);
+
+    if (policy == CapacityPolicy::Compact)
+        document.shrink_to_fit();
+    return document;
+}
+
+void xtree::sax_from_buffer(const char* buffer, size_t size, SaxHandler& handler) {
+    StringReader reader(buffer, size);
+    Parser<StringReader> parser(reader);
+    parser.parse(handler);
+}
+
+// ignores every event, so the parser only checks the document
+struct NullHandler {
+    void on_open(std::string_view, const std::vector<AttrView>&) {}
+
+    void on_close(std::string_view) {}
+
+    void on_text(std::string_view) {}
+
+    void on_cmnt(std::string_view) {}
+
+    void on_decl(std::string_view, const std::vector<AttrView>&) {}
+
+    void on_dtd(std::string_view) {}
+};
+
+std::optional<ParseFailure> xtree::validate(const char* buffer, size_t size) {
+    StringReader reader(buffer, size);
+    Parser<StringReader> parser(reader);
+    NullHandler handler;
+    if (parser.try_parse(handler))
+        return std::nullopt;
+
+    parser.failure.input = buffer;
+    return std::move(parser.failure);
+}
+
+void xtree::sax_from_stream(std::istream& stream, SaxHandler& handler) {
+    StreamReader reader(stream);
+    Parser<StreamReader> parser(reader);
+    parser.parse(handler);
+}
+
+void xtree::sax_from_file(const std::string& path, SaxHandler& handler) {
+#if MMAP_FILES
+    MappedFile mapped_file(path);
+    if (mapped_file.mapped) {
+        sax_from_buffer(mapped_file.data, mapped_file.size, handler);
+        return;
     }
-    attrs.erase(attrs.end() - static_cast<long long>(back), attrs.end());
-    attrs.shrink_to_fit();
+#endif
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file.good())
+        throw std::runtime_error("could not open file " + path);
+
+    sax_from_stream(file, handler);
 }
 
-void Document::remove_decls(const std::string& rtag) {
-    size_t back = 0;
-    for (size_t i = 0; i < children.size(); i++) {
-        BaseNode* node_ptr = &children[i];
+// records the node the parser emitted last, holding back the close of an elem without children until the next call
+struct PullHandler {
+    NodeKind kind = NodeKind::End;
+    std::string_view name;
+    std::string_view text;
+    const std::vector<AttrView>* attrs = nullptr;
+    bool pending_close = false;
+
+    void on_decl(std::string_view tag, const std::vector<AttrView>& decl_attrs) {
+        kind = NodeKind::Decl;
+        name = tag;
+        attrs = &decl_attrs;
+    }
 
-        if (back != 0) {
-            auto index = i - back;
-            children[index] = std::move(*node_ptr);
-            node_ptr = &children[index];
+    void on_dtd(std::string_view data) {
+        kind = NodeKind::Dtd;
+        text = data;
+    }
+
+    void on_open(std::string_view tag, const std::vector<AttrView>& open_attrs) {
+        kind = NodeKind::Open;
+        name = tag;
+        attrs = &open_attrs;
+    }
+
+    void on_close(std::string_view tag) {
+        // an elem without children emits its open and close in the same step
+        if (kind == NodeKind::Open) {
+            pending_close = true;
+            return;
         }
+        kind = NodeKind::Close;
+        name = tag;
+    }
 
-        if (node_ptr->is_decl() && node_ptr->as_decl().tag == rtag)
-            back++;
+    void on_text(std::string_view data) {
+        kind = NodeKind::Text;
+        text = data;
     }
-    children.erase(children.end() - static_cast<long long>(back), children.end());
-    children.shrink_to_fit();
+
+    void on_cmnt(std::string_view data) {
+        kind = NodeKind::Cmnt;
+        text = data;
+    }
+};
+
+struct xtree::ReaderState {
+    std::shared_ptr<const void> source;
+    StringReader reader;
+    Parser<StringReader> parser;
+    PullHandler handler;
+
+    ReaderState(const char* buffer, size_t size) : reader(buffer, size), parser(reader) {}
+};
+
+XmlReader::XmlReader(const char* buffer, size_t size) : state(std::make_unique<ReaderState>(buffer, size)) {}
+
+XmlReader::XmlReader(XmlReader&&) noexcept = default;
+
+XmlReader::~XmlReader() = default;
+
+XmlReader XmlReader::from_file(const std::string& path) {
+#if MMAP_FILES
+    auto mapped_file = std::make_shared<MappedFile>(path);
+    if (mapped_file->mapped) {
+        XmlReader reader(mapped_file->data, mapped_file->size);
+        reader.state->source = std::move(mapped_file);
+        return reader;
+    }
+#endif
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file.good())
+        throw std::runtime_error("could not open file " + path);
+
+    auto contents = std::make_shared<std::string>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    XmlReader reader(contents->data(), contents->size());
+    reader.state->source = std::move(contents);
+    return reader;
 }
 
-size_t Elem::normalize() {
-    std::stack<Elem*> stack;
-    stack.push(this);
+NodeKind XmlReader::next() {
+    auto& handler = state->handler;
+    if (handler.pending_close) {
+        handler.pending_close = false;
+        handler.kind = NodeKind::Close;
+        return handler.kind;
+    }
+    handler.kind = NodeKind::End;
+    state->parser.step(handler);
+    return handler.kind;
+}
 
-    size_t remove_count = 0;
+NodeKind XmlReader::kind() const {
+    return state->handler.kind;
+}
 
-    while (!stack.empty()) {
-        Elem* top = stack.top();
-        stack.pop();
+std::string_view XmlReader::name() const {
+    return state->handler.name;
+}
 
-        Text* prev_text = nullptr;
-        auto& curr_children = top->children;
-        size_t back = 0;
+const std::vector<AttrView>& XmlReader::attrs() const {
+    static const std::vector<AttrView> empty_attrs;
+    auto& handler = state->handler;
+    if (handler.attrs == nullptr || (handler.kind != NodeKind::Open && handler.kind != NodeKind::Decl))
+        return empty_attrs;
+    return *handler.attrs;
+}
 
-        for (size_t i = 0; i < curr_children.size(); i++) {
-            Node* child_ptr = &curr_children[i];
+const AttrView* XmlReader::select_attr(std::string_view attr_name) const {
+    for (auto& attr: attrs())
+        if (attr.name == attr_name)
+            return &attr;
+    return nullptr;
+}
 
-            if (back != 0) {
-                // shift the element back one by moving, depending on how many elements have been removed so far
-                auto index = i - back;
-                curr_children[index] = std::move(*child_ptr);
-                child_ptr = &curr_children[index];
-            }
+std::string_view XmlReader::text() const {
+    return state->handler.text;
+}
 
-            if (child_ptr->is_text()) {
-                auto& child_text = child_ptr->as_text();
-                if (prev_text != nullptr) {
-                    prev_text->data += child_text.data;
-                    remove_count++;
-                    back++;
+size_t XmlReader::depth() const {
+    return state->parser.depth() + (state->handler.pending_close ? 1 : 0);
+}
+
+void XmlReader::skip_subtree() {
+    auto& handler = state->handler;
+    if (handler.kind != NodeKind::Open)
+        return;
+    if (handler.pending_close) {
+        next();
+        return;
+    }
+
+    // step until the parser closes the elem the cursor is on, which is the last step that changes the depth back
+    auto target_depth = state->parser.depth() - 1;
+    while (state->parser.depth() > target_depth) {
+        handler.kind = NodeKind::End;
+        handler.pending_close = false;
+        if (!state->parser.step(handler))
+            return;
+    }
+}
+
+// reads the chunks fed to a push parser, only up to the end of the last tag fed unless the input is finished
+// the characters after that tag may belong to a token that is not complete yet, so they are held back from the parser
+struct ChunkReader {
+    static constexpr bool stable = false; // the consumed characters are discarded between chunks
+    static constexpr bool in_place = false;
+    static constexpr bool contiguous = false; // reading past the available characters must be recorded by get
+
+    std::string data;
+    size_t position = 0;
+    size_t end = 0;
+    bool finished = false;
+    size_t discarded = 0; // the number of consumed characters dropped from the front of the data
+    TextPosition discarded_position; // the row and col of the first character of the data
+    bool hit_end = false; // set when the parser reads past the characters available to it before the input is finished
+
+    i32 get() {
+        if (position >= end) {
+            hit_end = !finished;
+            return EOF;
+        }
+        return static_cast<unsigned char>(data[position++]);
+    }
+
+    std::string_view block() const {
+        return {data.data() + position, end - position};
+    }
+
+    void advance(size_t len) {
+        position += len;
+    }
+
+    bool unget(size_t len) {
+        position -= len;
+        return true;
+    }
+
+    void append(const char* chunk, size_t size) {
+        // drop the consumed characters once they outweigh the unconsumed ones, so the buffer stays proportional to a token
+        if (position > data.size() / 2) {
+            discarded_position = discarded_position.advanced(data.data(), data.data() + position);
+            discarded += position;
+            data.erase(0, position);
+            end -= position;
+            position = 0;
+        }
+
+        auto last_tag_end = std::string_view(chunk, size).rfind('>');
+        if (last_tag_end != std::string_view::npos)
+            end = data.size() + last_tag_end + 1;
+        data.append(chunk, size);
+    }
+
+    void finish() {
+        finished = true;
+        end = data.size();
+    }
+
+    TextPosition locate(size_t offset) const {
+        return discarded_position.advanced(data.data(), data.data() + (offset - discarded));
+    }
+};
+
+// the scan of a node that was cut off by the end of the available characters, which resumes where it stopped on every chunk
+// the parser only steps over the node again once it is complete, so a node fed in many chunks is read twice rather than once per chunk
+struct PendingNode {
+    enum class Kind { None, Start, Tag, Dtd, Cmnt, Text, Cdata };
+
+    Kind kind = Kind::None;
+    size_t offset = 0; // the offset of the input up to which the node has been scanned
+    size_t body = 0; // the offset of the content of a comment or cdata section, after its opening markup
+    char quote = 0; // the quote of the attr value a tag is scanned in, if any
+
+    void start(size_t at) {
+        *this = {Kind::Start, at, at, 0};
+    }
+
+    // scans the characters available to the parser, returns true once the node is complete
+    // the available characters always end with a '>', so the markup opening a node is never cut off
+    bool scan(const ChunkReader& reader) {
+        auto data = std::string_view(reader.data.data(), reader.end);
+        auto i = offset - reader.discarded;
+        auto ends_body = [&](size_t close, char c) {
+            return close >= body - reader.discarded + 2 && data[close - 1] == c && data[close - 2] == c;
+        };
+
+        while (i < data.size()) {
+            switch (kind) {
+            case Kind::None:
+                return true;
+            case Kind::Start: {
+                if (is_space(data[i])) {
+                    i++;
+                    break;
+                }
+                auto rest = data.substr(i);
+                if (rest.starts_with("<!--")) {
+                    kind = Kind::Cmnt;
+                    i += 4;
+                }
+                else if (rest.starts_with("<![CDATA[")) {
+                    kind = Kind::Cdata;
+                    i += 9;
+                }
+                else if (rest.starts_with("<!DOCTYPE")) {
+                    kind = Kind::Dtd;
+                    i += 9;
+                }
+                else if (rest.starts_with('<')) {
+                    kind = Kind::Tag;
+                    i += 1;
                 }
                 else {
-                    prev_text = &child_text;
+                    kind = Kind::Text;
                 }
+                body = reader.discarded + i;
+                break;
             }
-            else {
-                if (child_ptr->is_elem()) {
-                    auto elem = &child_ptr->as_elem();
-                    if (!elem->children.empty())
-                        stack.push(elem);
+            case Kind::Tag: {
+                // a tag or decl ends at the first '>' outside of its attr values
+                auto next = quote != 0 ? data.find(quote, i) : data.find_first_of("\"'>", i);
+                if (next == std::string_view::npos) {
+                    i = data.size();
+                    break;
                 }
-                prev_text = nullptr;
+                if (quote != 0)
+                    quote = 0;
+                else if (data[next] == '>')
+                    return true;
+                else
+                    quote = data[next];
+                i = next + 1;
+                break;
+            }
+            case Kind::Dtd: {
+                auto next = data.find('>', i);
+                if (next != std::string_view::npos)
+                    return true;
+                i = data.size();
+                break;
+            }
+            case Kind::Cmnt:
+            case Kind::Cdata: {
+                auto close = kind == Kind::Cmnt ? '-' : ']';
+                auto next = data.find('>', i);
+                if (next == std::string_view::npos) {
+                    i = data.size();
+                    break;
+                }
+                i = next + 1;
+                if (!ends_body(next, close))
+                    break;
+                if (kind == Kind::Cmnt)
+                    return true;
+                // the text continues after a cdata section, up to the next markup
+                kind = Kind::Text;
+                break;
+            }
+            case Kind::Text: {
+                auto next = data.find('<', i);
+                if (next == std::string_view::npos) {
+                    i = data.size();
+                    break;
+                }
+                if (!data.substr(next).starts_with("<![CDATA["))
+                    return true;
+                kind = Kind::Cdata;
+                i = next + 9;
+                body = reader.discarded + i;
+                break;
+            }
+            }
+            offset = reader.discarded + i;
+        }
+        offset = reader.discarded + i;
+        return false;
+    }
+};
+
+struct xtree::PushState {
+    Document document;
+    ChunkReader reader;
+    Parser<ChunkReader> parser;
+    DocumentBuilder builder;
+    PendingNode pending;
+
+    PushState() : parser(reader), builder(document) {}
+
+    // parses every node available to the parser, rewinding the node that was cut off by the end of the available characters
+    void parse_available() {
+        if (pending.kind != PendingNode::Kind::None && !pending.scan(reader))
+            return;
+        pending = {};
+
+        while (true) {
+            auto position = reader.position;
+            auto offset = parser.offset;
+            reader.hit_end = false;
+
+            bool stepped = parser.try_step(builder);
+            if (parser.failed) {
+                if (!reader.hit_end)
+                    parser.throw_failure();
+                parser.failed = false;
+                parser.rb.clear();
+                reader.position = position;
+                parser.offset = offset;
+                pending.start(reader.discarded + position);
+                return;
             }
+            parser.sync_block();
+            if (!stepped || reader.hit_end)
+                return;
         }
+    }
+};
 
-        curr_children.erase(curr_children.end() - static_cast<long long>(back), curr_children.end());
-        curr_children.shrink_to_fit();
+PushParser::PushParser() : state(std::make_unique<PushState>()) {}
+
+PushParser::PushParser(PushParser&&) noexcept = default;
+
+PushParser::~PushParser() = default;
+
+void PushParser::feed(const char* chunk, size_t size) {
+    auto end = state->reader.end;
+    state->reader.append(chunk, size);
+    if (state->reader.end != end)
+        state->parse_available();
+}
+
+Document PushParser::finish() {
+    state->reader.finish();
+    state->parser.parse(state->builder);
+    state->document.shrink_to_fit();
+
+    auto document = std::move(state->document);
+    state = std::make_unique<PushState>();
+    return document;
+}
+
+DocumentView DocumentView::from_buffer(const char* buffer, size_t size) {
+    DocumentView document(size);
+
+    StringReader reader(buffer, size);
+    Parser<StringReader> parser(reader);
+    DocumentViewBuilder builder(document, buffer, size);
+    parser.parse(builder);
+
+    return document;
+}
+
+ParseResult<DocumentView> DocumentView::try_from_buffer(const char* buffer, size_t size) {
+    DocumentView document(size);
+
+    StringReader reader(buffer, size);
+    Parser<StringReader> parser(reader);
+    DocumentViewBuilder builder(document, buffer, size);
+    if (!parser.try_parse(builder)) {
+        parser.failure.input = buffer;
+        return {std::move(parser.failure)};
+    }
+
+    return {std::move(document)};
+}
+
+DocumentView DocumentView::from_buffer_interned(const char* buffer, size_t size) {
+    DocumentView document(size);
+
+    StringReader reader(buffer, size);
+    Parser<StringReader> parser(reader);
+    SymbolCache symbols;
+    DocumentViewBuilder builder(document, buffer, size);
+    builder.symbols = &symbols;
+    parser.parse(builder);
+
+    return document;
+}
+
+DocumentView DocumentView::from_mutable_buffer(char* buffer, size_t size) {
+    DocumentView document(size);
+
+    InPlaceReader reader(buffer, size);
+    Parser<InPlaceReader> parser(reader);
+    DocumentViewBuilder builder(document, buffer, size);
+    parser.parse(builder);
+
+    return document;
+}
+
+DocumentView DocumentView::from_file(const std::string& path) {
+#if MMAP_FILES
+    // the mapping is owned by the document, since its nodes point into the mapped pages
+    auto mapped_file = std::make_shared<MappedFile>(path);
+    if (mapped_file->mapped) {
+        auto document = from_buffer(mapped_file->data, mapped_file->size);
+        document.source = std::move(mapped_file);
+        return document;
+    }
+#endif
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file.good())
+        throw std::runtime_error("could not open file " + path);
+
+    auto contents = std::make_shared<std::string>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    auto document = from_buffer(contents->data(), contents->size());
+    document.source = std::move(contents);
+    return document;
+}
+
+Elem* Elem::select_elem(const std::string& ctag) {
+    for (auto& child: children)
+        if (auto elem = get_if<std::unique_ptr<Elem>>(&child.data))
+            if ((*elem)->tag == ctag)
+                return elem->get();
+    return nullptr;
+}
+
+Attr* Elem::select_attr(const std::string& attr_name) {
+    for (auto& attr: attrs)
+        if (attr.name == attr_name)
+            return &attr;
+    return nullptr;
+}
+
+Elem& Elem::expect_elem(const std::string& ctag) {
+    for (auto& child: children)
+        if (auto elem = get_if<std::unique_ptr<Elem>>(&child.data))
+            if ((*elem)->tag == ctag)
+                return **elem;
+    throw NodeWalkException("elem does not contain child with tag name " + ctag);
+}
+
+Attr& Elem::expect_attr(const std::string& attr_name) {
+    for (auto& attr: attrs)
+        if (attr.name == attr_name)
+            return attr;
+    throw NodeWalkException("elem does not contain attribute with name " + attr_name);
+}
+
+const ElemView* ElemView::select_elem(std::string_view ctag) const {
+    for (auto& child: children)
+        if (auto elem = get_if<ElemView*>(&child.data))
+            if ((*elem)->tag == ctag)
+                return *elem;
+    return nullptr;
+}
+
+const AttrView* ElemView::select_attr(std::string_view attr_name) const {
+    for (auto& attr: attrs)
+        if (attr.name == attr_name)
+            return &attr;
+    return nullptr;
+}
+
+const ElemView& ElemView::expect_elem(std::string_view ctag) const {
+    for (auto& child: children)
+        if (auto elem = get_if<ElemView*>(&child.data))
+            if ((*elem)->tag == ctag)
+                return **elem;
+    throw NodeWalkException("elem does not contain child with tag name " + std::string(ctag));
+}
+
+const AttrView& ElemView::expect_attr(std::string_view attr_name) const {
+    for (auto& attr: attrs)
+        if (attr.name == attr_name)
+            return attr;
+    throw NodeWalkException("elem does not contain attribute with name " + std::string(attr_name));
+}
+
+const ElemView* ElemView::select_elem(Symbol ctag) const {
+    for (auto& child: children)
+        if (auto elem = get_if<ElemView*>(&child.data))
+            if ((*elem)->symbol == ctag)
+                return *elem;
+    return nullptr;
+}
+
+const AttrView* ElemView::select_attr(Symbol attr_name) const {
+    for (auto& attr: attrs)
+        if (attr.symbol == attr_name)
+            return &attr;
+    return nullptr;
+}
+
+const ElemView& ElemView::expect_elem(Symbol ctag) const {
+    if (auto elem = select_elem(ctag))
+        return *elem;
+    throw NodeWalkException("elem does not contain child with tag name " + std::string(ctag.name()));
+}
+
+const AttrView& ElemView::expect_attr(Symbol attr_name) const {
+    if (auto attr = select_attr(attr_name))
+        return *attr;
+    throw NodeWalkException("elem does not contain attribute with name " + std::string(attr_name.name()));
+}
+
+std::optional<Elem> Elem::remove_elem(const std::string& rtag) {
+    auto it = children.begin();
+    while (it != children.end()) {
+        auto& node = *it;
+        if (auto elem_ptr = std::get_if<std::unique_ptr<Elem>>(&node.data)) {
+            auto& elem = *elem_ptr;
+            if (elem->tag == rtag) {
+                auto ret = std::move(elem);
+                children.erase(it);
+                return std::move(*ret);
+            }
+        }
+        it++;
+    }
+    return std::nullopt;
+}
+
+std::optional<Attr> Elem::remove_attr(const std::string& name) {
+    auto it = attrs.begin();
+    while (it != attrs.end()) {
+        auto& attr = *it;
+        if (attr.name == name) {
+            auto ret = std::move(attr);
+            attrs.erase(it);
+            return ret;
+        }
+        it++;
+    }
+    return std::nullopt;
+}
+
+std::optional<Decl> Document::remove_decl(const std::string& rtag) {
+    auto it = children.begin();
+    while (it != children.end()) {
+        auto& node = *it;
+        if (auto decl = std::get_if<Decl>(&node.data)) {
+            if (decl->tag == rtag) {
+                auto ret = std::move(*decl);
+                children.erase(it);
+                return ret;
+            }
+        }
+        it++;
+    }
+    return std::nullopt;
+}
+
+void Elem::remove_elems(const std::string& rtag) {
+    size_t back = 0;
+    for (size_t i = 0; i < children.size(); i++) {
+        Node* node_ptr = &children[i];
+
+        if (back != 0) {
+            auto index = i - back;
+            children[index] = std::move(*node_ptr);
+            node_ptr = &children[index];
+        }
+
+        if (node_ptr->is_elem() && node_ptr->as_elem().tag == rtag)
+            back++;
+    }
+    children.erase(children.end() - static_cast<long long>(back), children.end());
+}
+
+void Elem::remove_attrs(const std::string& name) {
+    size_t back = 0;
+    for (size_t i = 0; i < attrs.size(); i++) {
+        Attr* attr_ptr = &attrs[i];
+
+        if (back != 0) {
+            auto index = i - back;
+            attrs[index] = std::move(*attr_ptr);
+            attr_ptr = &attrs[index];
+        }
+
+        if (attr_ptr->name == name)
+            back++;
+    }
+    attrs.erase(attrs.end() - static_cast<long long>(back), attrs.end());
+}
+
+void Document::remove_decls(const std::string& rtag) {
+    size_t back = 0;
+    for (size_t i = 0; i < children.size(); i++) {
+        BaseNode* node_ptr = &children[i];
+
+        if (back != 0) {
+            auto index = i - back;
+            children[index] = std::move(*node_ptr);
+            node_ptr = &children[index];
+        }
+
+        if (node_ptr->is_decl() && node_ptr->as_decl().tag == rtag)
+            back++;
+    }
+    children.erase(children.end() - static_cast<long long>(back), children.end());
+}
+
+size_t Elem::normalize() {
+    std::stack<Elem*> stack;
+    stack.push(this);
+
+    size_t remove_count = 0;
+
+    while (!stack.empty()) {
+        Elem* top = stack.top();
+        stack.pop();
+
+        Text* prev_text = nullptr;
+        auto& curr_children = top->children;
+        size_t back = 0;
+
+        for (size_t i = 0; i < curr_children.size(); i++) {
+            Node* child_ptr = &curr_children[i];
+
+            if (back != 0) {
+                // shift the element back one by moving, depending on how many elements have been removed so far
+                auto index = i - back;
+                curr_children[index] = std::move(*child_ptr);
+                child_ptr = &curr_children[index];
+            }
+
+            if (child_ptr->is_text()) {
+                auto& child_text = child_ptr->as_text();
+                if (prev_text != nullptr) {
+                    prev_text->data += child_text.data;
+                    remove_count++;
+                    back++;
+                }
+                else {
+                    prev_text = &child_text;
+                }
+            }
+            else {
+                if (child_ptr->is_elem()) {
+                    auto elem = &child_ptr->as_elem();
+                    if (!elem->children.empty())
+                        stack.push(elem);
+                }
+                prev_text = nullptr;
+            }
+        }
+
+        curr_children.erase(curr_children.end() - static_cast<long long>(back), curr_children.end());
+    }
+
+    return remove_count;
+}
+
+void Elem::shrink_to_fit() {
+    std::stack<Elem*> stack;
+    stack.push(this);
+
+    while (!stack.empty()) {
+        Elem* top = stack.top();
+        stack.pop();
+
+        top->attrs.shrink_to_fit();
+        top->children.shrink_to_fit();
+        for (auto& child: top->children)
+            if (child.is_elem())
+                stack.push(&child.as_elem());
+    }
+}
+
+Docstats xtree::stat_document(Document& document) {
+    Docstats stats{0, 0};
+
+    if (document.root != nullptr) {
+        stats.nodes_count++;
+
+        stats.total_mem += sizeof(Elem); // size of the elem, which is NOT stored in line with the node, and is therefore NOT counted in sizeof(Node)
+
+        stats.total_mem += document.root->attrs.capacity() * sizeof(Attr); // size of the entire attr vector
+        for (auto& attr : document.root->attrs) {
+            stats.total_mem += attr.name.capacity() + attr.value.capacity(); // strlen of the strings in the attr
+        }
+    }
+
+    walk_document(document,
+        [&stats](Node& node) {
+            stats.nodes_count++;
+            stats.total_mem += sizeof(Node); // size of the node itself (the largest of all variants which in this case is tie between cmnt and text)
+
+            if (node.is_elem()) {
+                auto& elem = node.as_elem();
+
+                stats.total_mem += sizeof(Elem); // size of the elem, which is NOT stored in line with the node, and is therefore NOT counted in sizeof(Node)
+
+                stats.total_mem += elem.attrs.capacity() * sizeof(Attr); // size of the entire attr vector
+                for (auto& attr : elem.attrs) {
+                    stats.total_mem += attr.name.capacity() + attr.value.capacity(); // strlen of the strings in the attr
+                }
+            }
+            else if (node.is_cmnt()) {
+                auto& cmnt = node.as_cmnt();
+                stats.total_mem += cmnt.data.capacity(); // strlen of the string
+            }
+            else if (node.is_text()) {
+                auto& text = node.as_text();
+                stats.total_mem += text.data.capacity(); // strlen of the string
+            } else {
+                throw std::runtime_error("unknown variant case");
+            }
+        },
+        [&stats](BaseNode& node) {
+            stats.nodes_count++;
+            stats.total_mem += sizeof(BaseNode); // size of the node itself (the largest of all variants which in this case is the decl)
+
+            if (node.is_decl()) {
+                auto& decl = node.as_decl();
+                stats.total_mem += decl.tag.capacity(); // strlen of the string
+
+                stats.total_mem += decl.attrs.capacity() * sizeof(Attr); // size of the entire attr vector
+                for (auto& attr : decl.attrs) {
+                    stats.total_mem += attr.name.capacity() + attr.value.capacity(); // strlen of the strings in the attr
+                }
+            }
+            else if (node.is_cmnt()) {
+                auto& cmnt = node.as_cmnt();
+                stats.total_mem += cmnt.data.capacity(); // strlen of the string
+            }
+            else if (node.is_dtd()) {
+                auto& dtd = node.as_dtd();
+                stats.total_mem += dtd.data.capacity(); // strlen of the string
+            }
+            else {
+                throw std::runtime_error("unknown variant case");
+            }
+        });
+
+    return stats;
+}
+
+Docstats xtree::stat_document(const DocumentView& document) {
+    Docstats stats{0, 0};
+
+    // elems, attrs, children and copied strings all live in the arena, so its size covers everything but the document's own nodes
+    stats.total_mem += document.arena->allocated;
+
+    for (auto& child: document.children) {
+        stats.nodes_count++;
+        stats.total_mem += sizeof(BaseNodeView); // size of the node itself
+        if (child.is_decl())
+            stats.total_mem += child.as_decl().attrs.capacity() * sizeof(AttrView); // size of the entire attr vector
+    }
+
+    std::stack<const ElemView*> stack;
+    if (document.root != nullptr) {
+        stats.nodes_count++;
+        stack.push(document.root);
+    }
+
+    while (!stack.empty()) {
+        auto top = stack.top();
+        stack.pop();
+
+        stats.nodes_count += top->children.size();
+        for (auto& child: top->children)
+            if (child.is_elem())
+                stack.push(&child.as_elem());
+    }
+
+    return stats;
+}
+
+// a stack frame for the copy view function to avoid a recursive-loop
+struct ViewCopyFrame {
+    const ElemView* view_ptr;
+    size_t view_i;
+    Elem* copy_ptr;
+};
+
+static Elem copy_elem_view(const ElemView& view) {
+    Elem elem((std::string(view.tag)));
+    elem.attrs.reserve(view.attrs.size());
+    for (auto& attr: view.attrs)
+        elem.attrs.emplace_back(std::string(attr.name), std::string(attr.value));
+    elem.children.reserve(view.children.size());
+    return elem;
+}
+
+void* Arena::do_allocate(size_t bytes, size_t alignment) {
+    allocated += bytes;
+    return std::pmr::monotonic_buffer_resource::do_allocate(bytes, alignment);
+}
+
+DocumentView::DocumentView(size_t input_size)
+    : arena(std::make_unique<Arena>(std::max<size_t>(input_size / 8, Arena::MIN_BLOCK_SIZ))) {}
+
+void DocumentView::clear() {
+    children.clear();
+    root = nullptr;
+    source = nullptr;
+    // a moved from document has no arena left to release, so it is given a new one to be reused with
+    if (arena == nullptr) {
+        arena = std::make_unique<Arena>(Arena::MIN_BLOCK_SIZ);
+        return;
+    }
+    arena->release();
+    arena->allocated = 0;
+}
+
+Elem ElemView::to_elem() const {
+    Elem elem = copy_elem_view(*this);
+
+    std::stack<ViewCopyFrame> stack;
+    stack.emplace(this, 0, &elem);
+
+    while (!stack.empty()) {
+        ViewCopyFrame& top = stack.top();
+
+        auto copy = top.copy_ptr;
+        auto curr = top.view_ptr;
+
+        if (top.view_i < curr->children.size()) {
+            auto& view_child = curr->children[top.view_i++];
+
+            if (view_child.is_elem()) {
+                auto view_elem_child = &view_child.as_elem();
+
+                auto copy_elem = std::make_unique<Elem>(copy_elem_view(*view_elem_child));
+                auto copy_elem_ptr = copy_elem.get();
+                copy->children.emplace_back(std::move(copy_elem));
+
+                stack.emplace(view_elem_child, 0, copy_elem_ptr);
+            }
+            else if (view_child.is_text()) {
+                copy->children.emplace_back(Text(std::string(view_child.as_text().data)));
+            }
+            else if (view_child.is_cmnt()) {
+                copy->children.emplace_back(Cmnt(std::string(view_child.as_cmnt().data)));
+            }
+            else {
+                throw std::runtime_error("unknown variant case");
+            }
+        } else {
+            stack.pop();
+        }
+    }
+
+    return elem;
+}
+
+static void copy_base_views(const std::vector<BaseNodeView>& children, Document& document) {
+    for (auto& child: children) {
+        if (child.is_decl()) {
+            auto& decl_view = child.as_decl();
+            Decl decl{std::string(decl_view.tag), {}};
+            for (auto& attr: decl_view.attrs)
+                decl.add_attr(std::string(attr.name), std::string(attr.value));
+            document.add_node(std::move(decl));
+        }
+        else if (child.is_cmnt()) {
+            document.add_node(Cmnt(std::string(child.as_cmnt().data)));
+        }
+        else if (child.is_dtd()) {
+            document.add_node(Dtd(std::string(child.as_dtd().data)));
+        }
+        else {
+            throw std::runtime_error("unknown variant case");
+        }
+    }
+}
+
+Document DocumentView::to_document() const {
+    Document document;
+    copy_base_views(children, document);
+
+    if (root != nullptr)
+        document.add_root(root->to_elem());
+
+    return document;
+}
+
+// the byte ranges of an elem in the input, from the start of its open tag to the end of its close tag
+struct LazySpan {
+    size_t begin;
+    size_t content_begin; // the end of the open tag, which is also the end of an elem without children
+    size_t end;
+    size_t descendants; // the number of elems nested in the elem, whose spans directly follow the elem's in the index
+};
+
+struct xtree::LazyIndex {
+    const char* input;
+    size_t size;
+    std::vector<LazySpan> spans; // in document order
+    Arena arena; // backs the parsed elems, their attr and child vectors, and the strings that could not be borrowed
+    std::shared_ptr<const void> source;
+
+    LazyIndex(const char* input, size_t size) : input(input), size(size), arena(Arena::MIN_BLOCK_SIZ) {}
+};
+
+// records the span of every elem by scanning for markup alone, without reading names, attrs or text
+// only the balance of open and close tags is checked here, the rest of an elem is checked when it is parsed
+struct LazyIndexer {
+    std::string_view input;
+    std::vector<LazySpan>& spans;
+    std::vector<size_t> open_spans; // the spans of the unclosed elems, innermost last
+
+    ParseException index_error(size_t position, const std::string& message, ParseError code) const {
+        auto text_position = TextPosition{}.advanced(input.data(), input.data() + position);
+        std::string error_message = message + " at row: " + std::to_string(text_position.row) + ", col: " + std::to_string(text_position.col);
+        return ParseException(error_message, code, position);
+    }
+
+    // the position after the terminator of a token whose body starts at position
+    size_t skip_past(size_t position, std::string_view terminator, const std::string& token_name) const {
+        auto found = input.find(terminator, position);
+        if (found == std::string_view::npos)
+            throw index_error(input.size(), "reached end of stream while parsing " + token_name, ParseError::EndOfStream);
+        return found + terminator.size();
+    }
+
+    // the position after the end of an open tag whose name starts at position, skipping over quoted attr values
+    size_t skip_open_tag(size_t position) const {
+        auto end = input.data() + input.size();
+        auto c = input.data() + position;
+        while (true) {
+            c = scan_delims<'>', '"', '\''>(c, end);
+            if (c == end)
+                throw index_error(input.size(), "reached end of stream while parsing a tag", ParseError::EndOfStream);
+            if (*c == '>')
+                return c - input.data() + 1;
+
+            auto quote = static_cast<const char*>(std::memchr(c + 1, *c, end - c - 1));
+            if (quote == nullptr)
+                throw index_error(input.size(), "reached end of stream while parsing an attr value", ParseError::EndOfStream);
+            c = quote + 1;
+        }
+    }
+
+    void index() {
+        size_t position = 0;
+        while ((position = input.find('<', position)) != std::string_view::npos) {
+            auto markup = input.substr(position);
+            if (markup.starts_with("<!--")) {
+                position = skip_past(position + 4, "-->", "a comment");
+            }
+            else if (markup.starts_with("<![CDATA[")) {
+                position = skip_past(position + 9, "]]>", "cdata");
+            }
+            else if (markup.starts_with("<?")) {
+                position = skip_past(position + 2, "?>", "a decl");
+            }
+            else if (markup.starts_with("<!")) {
+                position = skip_past(position + 2, ">", "a doctype");
+            }
+            else if (markup.starts_with("</")) {
+                if (open_spans.empty())
+                    throw index_error(position, "expected data or a <open-tag>, <open-dtd>, <open-comment> or <open-decl> symbol, got an end tag", ParseError::InvalidRootOpenTok);
+
+                auto end = skip_past(position + 2, ">", "an end tag");
+                auto& span = spans[open_spans.back()];
+                span.end = end;
+                span.descendants = spans.size() - open_spans.back() - 1;
+                open_spans.pop_back();
+                position = end;
+            }
+            else {
+                if (open_spans.empty() && !spans.empty())
+                    throw index_error(position, "expected an xml document to only have a single root node", ParseError::MultipleRoots);
+
+                auto end = skip_open_tag(position + 1);
+                spans.push_back({position, end, end, 0});
+                if (input[end - 2] != '/')
+                    open_spans.push_back(spans.size() - 1);
+                position = end;
+            }
+        }
+
+        if (!open_spans.empty())
+            throw index_error(input.size(), "reached end of stream while parsing element children", ParseError::EndOfStream);
+    }
+};
+
+// builds the nodes outside the root of a lazy document
+struct LazyDocumentBuilder {
+    LazyDocument& document;
+    LazyIndex& index;
+
+    std::string_view keep(std::string_view str) {
+        return keep_string(index.arena, index.input, index.input + index.size, str);
+    }
+
+    void on_open(std::string_view, const std::vector<AttrView>&) {
+        // the root is skipped over rather than parsed, and the index pass rejects any other elem outside it
+        assert(false);
+    }
+
+    void on_close(std::string_view) {}
+
+    void on_text(std::string_view) {}
+
+    void on_cmnt(std::string_view data) {
+        document.children.emplace_back(CmntView(keep(data)));
+    }
+
+    void on_decl(std::string_view tag, const std::vector<AttrView>& attrs) {
+        DeclView decl{keep(tag), {}};
+        decl.attrs.reserve(attrs.size());
+        for (auto& attr: attrs)
+            decl.attrs.emplace_back(keep(attr.name), keep(attr.value));
+        document.children.emplace_back(std::move(decl));
+    }
+
+    void on_dtd(std::string_view data) {
+        document.children.emplace_back(DtdView(keep(data)));
+    }
+};
+
+// builds the tag, attrs and children of a single lazy elem, whose child elems are added unparsed
+struct LazyElemBuilder {
+    LazyElem& elem;
+    LazyIndex& index;
+
+    std::string_view keep(std::string_view str) {
+        return keep_string(index.arena, index.input, index.input + index.size, str);
+    }
+
+    void on_open(std::string_view tag, const std::vector<AttrView>& attrs) {
+        elem.parsed_tag = keep(tag);
+        elem.parsed_attrs.reserve(attrs.size());
+        for (auto& attr: attrs)
+            elem.parsed_attrs.emplace_back(keep(attr.name), keep(attr.value));
+    }
+
+    // the parser matches the close tag against the elem's tag, which is pushed as the open elem before its content is parsed
+    void on_close(std::string_view) {}
+
+    void on_text(std::string_view data) {
+        elem.parsed_children.emplace_back(TextView(keep(data)));
+    }
+
+    void on_cmnt(std::string_view data) {
+        elem.parsed_children.emplace_back(CmntView(keep(data)));
+    }
+};
+
+static void parse_lazy_tag(LazyElem& elem) {
+    auto& index = *elem.index;
+    auto& span = index.spans[elem.span];
+
+    // the reader starts partway through the input, so that errors are located relative to the entire input
+    elem.parsed_attrs.clear();
+    StringReader reader(index.input, span.content_begin);
+    reader.position = span.begin;
+    Parser<StringReader> parser(reader);
+    parser.offset = span.begin;
+    LazyElemBuilder builder{elem, index};
+    parser.step_fragment(builder);
+
+    elem.tag_parsed = true;
+}
+
+static void parse_lazy_children(LazyElem& elem) {
+    if (!elem.tag_parsed)
+        parse_lazy_tag(elem);
+
+    auto& index = *elem.index;
+    auto& span = index.spans[elem.span];
+    LazyElemBuilder builder{elem, index};
+    std::pmr::polymorphic_allocator<LazyElem> allocator(&index.arena);
+
+    elem.parsed_children.clear();
+    StringReader reader(index.input, span.end);
+    reader.position = span.content_begin;
+    Parser<StringReader> parser(reader);
+    parser.offset = span.content_begin;
+    parser.push_tag(elem.parsed_tag);
+
+    // the content and close tag are parsed as a fragment, except that each child elem is skipped over in a single jump to the end of its span
+    // the close tag is parsed together with the content, so that text right before it ends at its '<' rather than the end of the input
+    auto child = elem.span + 1;
+    auto last_child = elem.span + span.descendants;
+    while (true) {
+        parser.skip_spaces();
+        parser.sync_block();
+
+        if (child <= last_child && reader.position == index.spans[child].begin) {
+            auto& child_span = index.spans[child];
+            elem.parsed_children.emplace_back(allocator.new_object<LazyElem>(&index, child, &index.arena));
+            parser.consume_run(child_span.end - child_span.begin);
+            child += child_span.descendants + 1;
+            continue;
+        }
+        if (!parser.step_fragment(builder))
+            break;
+    }
+
+    elem.children_parsed = true;
+}
+
+std::string_view LazyElem::tag() {
+    if (!tag_parsed)
+        parse_lazy_tag(*this);
+    return parsed_tag;
+}
+
+const std::pmr::vector<AttrView>& LazyElem::attrs() {
+    if (!tag_parsed)
+        parse_lazy_tag(*this);
+    return parsed_attrs;
+}
+
+const std::pmr::vector<LazyNode>& LazyElem::children() {
+    if (!children_parsed)
+        parse_lazy_children(*this);
+    return parsed_children;
+}
+
+LazyElem* LazyElem::select_elem(std::string_view ctag) {
+    for (auto& child: children())
+        if (auto elem = get_if<LazyElem*>(&child.data))
+            if ((*elem)->tag() == ctag)
+                return *elem;
+    return nullptr;
+}
+
+const AttrView* LazyElem::select_attr(std::string_view attr_name) {
+    for (auto& attr: attrs())
+        if (attr.name == attr_name)
+            return &attr;
+    return nullptr;
+}
+
+LazyElem& LazyElem::expect_elem(std::string_view ctag) {
+    if (auto elem = select_elem(ctag))
+        return *elem;
+    throw NodeWalkException("elem does not contain child with tag name " + std::string(ctag));
+}
+
+const AttrView& LazyElem::expect_attr(std::string_view attr_name) {
+    if (auto attr = select_attr(attr_name))
+        return *attr;
+    throw NodeWalkException("elem does not contain attribute with name " + std::string(attr_name));
+}
+
+// a stack frame for the lazy copy function to avoid a recursive-loop
+struct LazyCopyFrame {
+    LazyElem* lazy_ptr;
+    size_t lazy_i;
+    Elem* copy_ptr;
+};
+
+static Elem copy_lazy_elem(LazyElem& lazy) {
+    Elem elem((std::string(lazy.tag())));
+    elem.attrs.reserve(lazy.attrs().size());
+    for (auto& attr: lazy.attrs())
+        elem.attrs.emplace_back(std::string(attr.name), std::string(attr.value));
+    elem.children.reserve(lazy.children().size());
+    return elem;
+}
+
+Elem LazyElem::to_elem() {
+    Elem elem = copy_lazy_elem(*this);
+
+    std::stack<LazyCopyFrame> stack;
+    stack.emplace(this, 0, &elem);
+
+    while (!stack.empty()) {
+        LazyCopyFrame& top = stack.top();
+
+        auto copy = top.copy_ptr;
+        auto& lazy_children = top.lazy_ptr->children();
+
+        if (top.lazy_i < lazy_children.size()) {
+            auto& lazy_child = lazy_children[top.lazy_i++];
+
+            if (lazy_child.is_elem()) {
+                auto lazy_elem_child = &lazy_child.as_elem();
+
+                auto copy_elem = std::make_unique<Elem>(copy_lazy_elem(*lazy_elem_child));
+                auto copy_elem_ptr = copy_elem.get();
+                copy->children.emplace_back(std::move(copy_elem));
+
+                stack.emplace(lazy_elem_child, 0, copy_elem_ptr);
+            }
+            else if (lazy_child.is_text()) {
+                copy->children.emplace_back(Text(std::string(lazy_child.as_text().data)));
+            }
+            else if (lazy_child.is_cmnt()) {
+                copy->children.emplace_back(Cmnt(std::string(lazy_child.as_cmnt().data)));
+            }
+            else {
+                throw std::runtime_error("unknown variant case");
+            }
+        } else {
+            stack.pop();
+        }
+    }
+
+    return elem;
+}
+
+LazyDocument::LazyDocument() = default;
+
+LazyDocument::LazyDocument(LazyDocument&&) noexcept = default;
+
+LazyDocument& LazyDocument::operator=(LazyDocument&&) noexcept = default;
+
+LazyDocument::~LazyDocument() = default;
+
+LazyDocument LazyDocument::from_buffer(const char* buffer, size_t size) {
+    LazyDocument document;
+    document.index = std::make_unique<LazyIndex>(buffer, size);
+    auto& index = *document.index;
+
+    LazyIndexer indexer{std::string_view(buffer, size), index.spans, {}};
+    indexer.index();
+
+    // the nodes outside the root are parsed up front, jumping over the root's span once the parser reaches it
+    StringReader reader(buffer, size);
+    Parser<StringReader> parser(reader);
+    LazyDocumentBuilder builder{document, index};
+    while (true) {
+        parser.skip_spaces();
+        parser.sync_block();
+
+        if (!index.spans.empty() && !parser.parsed_root && reader.position == index.spans[0].begin) {
+            std::pmr::polymorphic_allocator<LazyElem> allocator(&index.arena);
+            document.root = allocator.new_object<LazyElem>(&index, 0, &index.arena);
+            parser.consume_run(index.spans[0].end - index.spans[0].begin);
+            parser.parsed_root = true;
+            continue;
+        }
+        if (!parser.step(builder))
+            break;
+    }
+
+    return document;
+}
+
+LazyDocument LazyDocument::from_file(const std::string& path) {
+#if MMAP_FILES
+    auto mapped_file = std::make_shared<MappedFile>(path);
+    if (mapped_file->mapped) {
+        auto document = from_buffer(mapped_file->data, mapped_file->size);
+        document.index->source = std::move(mapped_file);
+        return document;
+    }
+#endif
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file.good())
+        throw std::runtime_error("could not open file " + path);
+
+    auto contents = std::make_shared<std::string>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    auto document = from_buffer(contents->data(), contents->size());
+    document.index->source = std::move(contents);
+    return document;
+}
+
+Document LazyDocument::to_document() const {
+    Document document;
+    copy_base_views(children, document);
+
+    if (root != nullptr)
+        document.add_root(root->to_elem());
+
+    return document;
+}
+
+// fills a flat document from the events of a parser, appending every node to the end of the document's nodes
+struct FlatDocumentBuilder {
+    FlatDocument& document;
+    std::vector<uint32_t> stack; // the open elems
+    std::vector<uint32_t> last_children; // the last child of each open elem, used to link the next child as its sibling
+    uint32_t last_top = FlatNode::NONE; // the last node outside of any elem
+
+    explicit FlatDocumentBuilder(FlatDocument& document) : document(document) {}
+
+    FlatString add_string(std::string_view str) {
+        FlatString flat_str{document.strings.size(), str.size()};
+        document.strings.append(str);
+        return flat_str;
+    }
+
+    uint32_t add_node(FlatKind kind, std::string_view data) {
+        if (document.nodes.size() >= FlatNode::NONE)
+            throw std::length_error("flat document cannot hold more than 2^32 - 1 nodes");
+
+        auto index = static_cast<uint32_t>(document.nodes.size());
+        auto& node = document.nodes.emplace_back();
+        node.kind = kind;
+        node.data = add_string(data);
+
+        auto& last = stack.empty() ? last_top : last_children.back();
+        if (!stack.empty()) {
+            node.parent = stack.back();
+            if (last == FlatNode::NONE)
+                document.nodes[stack.back()].first_child = index;
+        }
+        if (last != FlatNode::NONE)
+            document.nodes[last].next_sibling = index;
+        last = index;
+
+        return index;
+    }
+
+    void add_attrs(uint32_t index, const std::vector<AttrView>& attrs) {
+        auto& node = document.nodes[index];
+        node.attrs_begin = static_cast<uint32_t>(document.attrs.size());
+        node.attrs_count = static_cast<uint32_t>(attrs.size());
+        for (auto& attr: attrs)
+            document.attrs.push_back({add_string(attr.name), add_string(attr.value)});
+    }
+
+    void on_open(std::string_view tag, const std::vector<AttrView>& attrs) {
+        auto index = add_node(FlatKind::Elem, tag);
+        add_attrs(index, attrs);
+
+        if (stack.empty())
+            document.root = index;
+        stack.push_back(index);
+        last_children.push_back(FlatNode::NONE);
+    }
+
+    void on_close(std::string_view) {
+        stack.pop_back();
+        last_children.pop_back();
+    }
+
+    void on_text(std::string_view data) {
+        add_node(FlatKind::Text, data);
+    }
+
+    void on_cmnt(std::string_view data) {
+        add_node(FlatKind::Cmnt, data);
+    }
+
+    void on_decl(std::string_view tag, const std::vector<AttrView>& attrs) {
+        auto index = add_node(FlatKind::Decl, tag);
+        add_attrs(index, attrs);
+    }
+
+    void on_dtd(std::string_view data) {
+        add_node(FlatKind::Dtd, data);
+    }
+};
+
+FlatDocument FlatDocument::from_buffer(const char* buffer, size_t size) {
+    FlatDocument document;
+
+    StringReader reader(buffer, size);
+    Parser<StringReader> parser(reader);
+    FlatDocumentBuilder builder(document);
+    parser.parse(builder);
+
+    return document;
+}
+
+FlatDocument FlatDocument::from_file(const std::string& path) {
+#if MMAP_FILES
+    // the document copies its strings into its pool, so the mapping can be released once it is parsed
+    MappedFile mapped_file(path);
+    if (mapped_file.mapped)
+        return from_buffer(mapped_file.data, mapped_file.size);
+#endif
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file.good())
+        throw std::runtime_error("could not open file " + path);
+
+    FlatDocument document;
+
+    StreamReader reader(file);
+    Parser<StreamReader> parser(reader);
+    FlatDocumentBuilder builder(document);
+    parser.parse(builder);
+
+    return document;
+}
+
+const FlatNode& FlatNodeRef::node() const {
+    return document->nodes[index];
+}
+
+FlatElem FlatNodeRef::as_elem() const {
+    if (is_elem())
+        return {document, index};
+    throw NodeWalkException("node is not an elem type node");
+}
+
+TextView FlatNodeRef::as_text() const {
+    if (is_text())
+        return {document->string(node().data)};
+    throw NodeWalkException("node is not a data type node");
+}
+
+CmntView FlatNodeRef::as_cmnt() const {
+    if (is_cmnt())
+        return {document->string(node().data)};
+    throw NodeWalkException("node is not a comment type node");
+}
+
+FlatChildIterator& FlatChildIterator::operator++() {
+    index = document->nodes[index].next_sibling;
+    return *this;
+}
+
+const FlatNode& FlatElem::node() const {
+    return document->nodes[index];
+}
+
+std::string_view FlatElem::tag() const {
+    return document->string(node().data);
+}
+
+AttrView FlatElem::nth_attr(size_t i) const {
+    auto& flat_node = node();
+    if (i >= flat_node.attrs_count)
+        throw NodeWalkException(std::to_string(i) + "th attr is out of bounds");
+
+    auto& attr = document->attrs[flat_node.attrs_begin + i];
+    return {document->string(attr.name), document->string(attr.value), Symbol{}};
+}
+
+std::optional<AttrView> FlatElem::select_attr(std::string_view attr_name) const {
+    auto& flat_node = node();
+    for (size_t i = 0; i < flat_node.attrs_count; i++) {
+        auto& attr = document->attrs[flat_node.attrs_begin + i];
+        if (document->string(attr.name) == attr_name)
+            return AttrView{document->string(attr.name), document->string(attr.value), Symbol{}};
+    }
+    return std::nullopt;
+}
+
+AttrView FlatElem::expect_attr(std::string_view attr_name) const {
+    if (auto attr = select_attr(attr_name))
+        return *attr;
+    throw NodeWalkException("elem does not contain attribute with name " + std::string(attr_name));
+}
+
+std::optional<FlatElem> FlatElem::select_elem(std::string_view ctag) const {
+    for (auto child: *this)
+        if (child.is_elem() && document->string(child.node().data) == ctag)
+            return FlatElem{document, child.index};
+    return std::nullopt;
+}
+
+FlatElem FlatElem::expect_elem(std::string_view ctag) const {
+    if (auto elem = select_elem(ctag))
+        return *elem;
+    throw NodeWalkException("elem does not contain child with tag name " + std::string(ctag));
+}
+
+FlatNodeRef FlatElem::nth_child(size_t i) const {
+    size_t n = 0;
+    for (auto child: *this)
+        if (n++ == i)
+            return child;
+    throw NodeWalkException(std::to_string(i) + "th child is out of bounds");
+}
+
+static Elem copy_flat_elem(FlatElem flat) {
+    Elem elem((std::string(flat.tag())));
+    elem.attrs.reserve(flat.attrs_count());
+    for (size_t i = 0; i < flat.attrs_count(); i++) {
+        auto attr = flat.nth_attr(i);
+        elem.attrs.emplace_back(std::string(attr.name), std::string(attr.value));
+    }
+    return elem;
+}
+
+Elem FlatElem::to_elem() const {
+    Elem elem = copy_flat_elem(*this);
+
+    // the subtree follows the elem in document order, so each node's copied parent is already on the stack when the node is reached
+    std::vector<std::pair<uint32_t, Elem*>> stack{{index, &elem}};
+    auto& nodes = document->nodes;
+
+    for (uint32_t i = index + 1; i < nodes.size() && nodes[i].parent != FlatNode::NONE; i++) {
+        auto& flat_node = nodes[i];
+        while (stack.back().first != flat_node.parent) {
+            stack.pop_back();
+            if (stack.empty())
+                return elem;
+        }
+
+        auto parent = stack.back().second;
+        switch (flat_node.kind) {
+        case FlatKind::Elem: {
+            auto copy_elem = std::make_unique<Elem>(copy_flat_elem({document, i}));
+            auto copy_elem_ptr = copy_elem.get();
+            parent->children.emplace_back(std::move(copy_elem));
+            stack.emplace_back(i, copy_elem_ptr);
+            break;
+        }
+        case FlatKind::Text:
+            parent->children.emplace_back(Text(std::string(document->string(flat_node.data))));
+            break;
+        case FlatKind::Cmnt:
+            parent->children.emplace_back(Cmnt(std::string(document->string(flat_node.data))));
+            break;
+        default:
+            throw std::runtime_error("unknown variant case");
+        }
     }
 
-    return remove_count;
+    return elem;
 }
 
-Docstats xtree::stat_document(Document& document) {
-    Docstats stats{0, 0};
-
-    if (document.root != nullptr) {
-        stats.nodes_count++;
-
-        stats.total_mem += sizeof(Elem); // size of the elem, which is NOT stored in line with the node, and is therefore NOT counted in sizeof(Node)
+Document FlatDocument::to_document() const {
+    Document document;
 
-        stats.total_mem += document.root->attrs.capacity() * sizeof(Attr); // size of the entire attr vector
-        for (auto& attr : document.root->attrs) {
-            stats.total_mem += attr.name.capacity() + attr.value.capacity(); // strlen of the strings in the attr
+    for (uint32_t i = 0; i < nodes.size(); i = nodes[i].next_sibling) {
+        auto& node = nodes[i];
+        switch (node.kind) {
+        case FlatKind::Elem:
+            document.add_root(FlatElem{this, i}.to_elem());
+            break;
+        case FlatKind::Cmnt:
+            document.add_node(Cmnt(std::string(string(node.data))));
+            break;
+        case FlatKind::Dtd:
+            document.add_node(Dtd(std::string(string(node.data))));
+            break;
+        case FlatKind::Decl: {
+            Decl decl{std::string(string(node.data)), {}};
+            for (uint32_t j = 0; j < node.attrs_count; j++) {
+                auto& attr = attrs[node.attrs_begin + j];
+                decl.add_attr(std::string(string(attr.name)), std::string(string(attr.value)));
+            }
+            document.add_node(std::move(decl));
+            break;
+        }
+        default:
+            throw std::runtime_error("unknown variant case");
         }
     }
 
-    walk_document(document,
-        [&stats](Node& node) {
-            stats.nodes_count++;
-            stats.total_mem += sizeof(Node); // size of the node itself (the largest of all variants which in this case is tie between cmnt and text)
-
-            if (node.is_elem()) {
-                auto& elem = node.as_elem();
+    return document;
+}
 
-                stats.total_mem += sizeof(Elem); // size of the elem, which is NOT stored in line with the node, and is therefore NOT counted in sizeof(Node)
+Docstats xtree::stat_document(const FlatDocument& document) {
+    Docstats stats{0, 0};
+    stats.nodes_count = document.nodes.size();
+    stats.total_mem += document.nodes.capacity() * sizeof(FlatNode);
+    stats.total_mem += document.attrs.capacity() * sizeof(FlatAttr);
+    stats.total_mem += document.strings.capacity();
+    return stats;
+}
 
-                stats.total_mem += elem.attrs.capacity() * sizeof(Attr); // size of the entire attr vector
-                for (auto& attr : elem.attrs) {
-                    stats.total_mem += attr.name.capacity() + attr.value.capacity(); // strlen of the strings in the attr
-                }
-            }
-            else if (node.is_cmnt()) {
-                auto& cmnt = node.as_cmnt();
-                stats.total_mem += cmnt.data.capacity(); // strlen of the string
-            }
-            else if (node.is_text()) {
-                auto& text = node.as_text();
-                stats.total_mem += text.data.capacity(); // strlen of the string
-            } else {
-                throw std::runtime_error("unknown variant case");
-            }
-        },
-        [&stats](BaseNode& node) {
-            stats.nodes_count++;
-            stats.total_mem += sizeof(BaseNode); // size of the node itself (the largest of all variants which in this case is the decl)
+// the layout of a flat document is determined by its tree, so equal documents have equal arrays and are compared front to back
+bool xtree::operator==(const FlatDocument& document, const FlatDocument& other) {
+    if (document.nodes.size() != other.nodes.size() || document.attrs.size() != other.attrs.size())
+        return false;
 
-            if (node.is_decl()) {
-                auto& decl = node.as_decl();
-                stats.total_mem += decl.tag.capacity(); // strlen of the string
+    for (size_t i = 0; i < document.nodes.size(); i++) {
+        auto& node = document.nodes[i];
+        auto& other_node = other.nodes[i];
+        if (node.kind != other_node.kind || node.parent != other_node.parent || node.first_child != other_node.first_child ||
+            node.next_sibling != other_node.next_sibling || node.attrs_count != other_node.attrs_count ||
+            document.string(node.data) != other.string(other_node.data))
+            return false;
+    }
 
-                stats.total_mem += decl.attrs.capacity() * sizeof(Attr); // size of the entire attr vector
-                for (auto& attr : decl.attrs) {
-                    stats.total_mem += attr.name.capacity() + attr.value.capacity(); // strlen of the strings in the attr
-                }
-            }
-            else if (node.is_cmnt()) {
-                auto& cmnt = node.as_cmnt();
-                stats.total_mem += cmnt.data.capacity(); // strlen of the string
-            }
-            else if (node.is_dtd()) {
-                auto& dtd = node.as_dtd();
-                stats.total_mem += dtd.data.capacity(); // strlen of the string
-            }
-            else {
-                throw std::runtime_error("unknown variant case");
-            }
-        });
+    for (size_t i = 0; i < document.attrs.size(); i++) {
+        auto& attr = document.attrs[i];
+        auto& other_attr = other.attrs[i];
+        if (document.string(attr.name) != other.string(other_attr.name) || document.string(attr.value) != other.string(other_attr.value))
+            return false;
+    }
 
-    return stats;
+    return true;
 }
 
 // a stack frame for the copy element function to avoid a recursive-loop
@@ -1190,86 +3908,194 @@ bool xtree::operator==(const Document& document, const Document& other) {
     return true;
 }
 
-std::ostream& xtree::operator<<(std::ostream& os, const Attr& attr) {
-    os << attr.name << "=" << "\"";
-    for (auto c: attr.value) {
-        switch (c) {
-        case '"': os << "&quot;"; break;
-        case '\'': os << "&apos;"; break;
-        case '<': os << "&lt;"; break;
-        case '>': os << "&gt;"; break;
-        case '&': os << "&amp;"; break;
-        default: os << c;
+// collects serialized output in a single contiguous buffer, which is handed to a stream, string or file descriptor in large blocks
+struct Writer {
+    static constexpr size_t BLOCK_SIZ = 64 * 1024; // the buffer is flushed once it holds at least this many characters
+
+    std::string buffer;
+    std::ostream* os = nullptr;
+    std::string* str = nullptr;
+    int fd = -1;
+    OutputStyle style = OutputStyle::Padded;
+
+    // a single node streamed on its own lets the buffer grow to its size, only whole documents reserve a full block up front
+    explicit Writer(std::ostream& os, size_t capacity = 0) : os(&os) {
+        buffer.reserve(capacity);
+    }
+
+    explicit Writer(int fd, OutputStyle style) : fd(fd), style(style) {
+        buffer.reserve(BLOCK_SIZ);
+    }
+
+    // the string grows geometrically as blocks are appended to it, while the writes themselves stay within the block
+    explicit Writer(std::string& str, OutputStyle style) : str(&str), style(style) {
+        buffer.reserve(BLOCK_SIZ);
+    }
+
+    void write(std::string_view str) {
+        buffer.append(str);
+        if (buffer.size() >= BLOCK_SIZ)
+            flush();
+    }
+
+    void put(char c) {
+        buffer.push_back(c);
+        if (buffer.size() >= BLOCK_SIZ)
+            flush();
+    }
+
+    // hands the buffered output to the stream, string or file descriptor
+    void flush() {
+        if (os != nullptr) {
+            os->write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        }
+        else if (str != nullptr) {
+            str->append(buffer);
+        }
+        else {
+            size_t written = 0;
+            while (written < buffer.size()) {
+#if MMAP_FILES
+                auto count = ::write(fd, buffer.data() + written, buffer.size() - written);
+                if (count < 0 && errno == EINTR)
+                    continue;
+#else
+                auto count = _write(fd, buffer.data() + written, static_cast<unsigned>(buffer.size() - written));
+#endif
+                if (count <= 0)
+                    throw std::runtime_error("could not write to file descriptor " + std::to_string(fd));
+                written += static_cast<size_t>(count);
+            }
         }
+        buffer.clear();
+    }
+};
+
+// counts the characters that writing would output, so the output can be written into a buffer of exactly that size
+struct SizeCounter {
+    OutputStyle style;
+    size_t size = 0;
+
+    void write(std::string_view str) {
+        size += str.size();
+    }
+
+    void put(char) {
+        size += 1;
+    }
+};
+
+// writes into a buffer that was sized by a SizeCounter, so no write needs to check the space left
+struct BufferWriter {
+    OutputStyle style;
+    char* pos;
+
+    void write(std::string_view str) {
+        std::memcpy(pos, str.data(), str.size());
+        pos += str.size();
+    }
+
+    void put(char c) {
+        *pos++ = c;
+    }
+};
+
+static std::string_view escape_of(char c) {
+    switch (c) {
+    case '"': return "&quot;";
+    case '\'': return "&apos;";
+    case '<': return "&lt;";
+    case '>': return "&gt;";
+    default: return "&amp;";
     }
-    os << "\"";
-    return os;
 }
 
-std::ostream& xtree::operator<<(std::ostream& os, const Text& text) {
-    for (auto c: text.data) {
-        switch (c) {
-        case '"': os << "&quot;"; break;
-        case '\'': os << "&apos;"; break;
-        case '<': os << "&lt;"; break;
-        case '>': os << "&gt;"; break;
-        case '&': os << "&amp;"; break;
-        default: os << c;
-        }
+// writes the string with the delimiters replaced by their escapes, the runs between them are written at once
+// the next character to escape is found a vector register at a time, since most strings contain none
+template <char... Delims, class Out>
+static void write_escaped(Out& out, std::string_view str) {
+    auto begin = str.data();
+    auto end = begin + str.size();
+    while (true) {
+        auto next = scan_delims<Delims...>(begin, end);
+        out.write(std::string_view(begin, next - begin));
+        if (next == end)
+            return;
+
+        // a compact text only escapes a '>' where it would end a cdata close "]]>"
+        if (*next == '>' && out.style == OutputStyle::Compact && (next - str.data() < 2 || next[-1] != ']' || next[-2] != ']'))
+            out.put('>');
+        else
+            out.write(escape_of(*next));
+        begin = next + 1;
     }
-    os << ' ';
-    return os;
 }
 
-std::ostream& xtree::operator<<(std::ostream& os, const Decl& decl) {
-    os << "<?" << decl.tag;
-    for (size_t i = 0; i < decl.attrs.size(); i++) {
-        if (i == 0)
-            os << " ";
-        os << decl.attrs[i];
-        if (i < decl.attrs.size() - 1)
-            os << " ";
-    }
-    os << "?> ";
-    return os;
+// the padding after each node, which compact output leaves out
+template <class Out>
+static void write_pad(Out& writer) {
+    if (writer.style == OutputStyle::Padded)
+        writer.put(' ');
 }
 
-std::ostream& xtree::operator<<(std::ostream& os, const Document& document) {
-    for (auto& node: document.children)
-        os << node;
-    if (document.root != nullptr)
-        os << *document.root;
-    return os;
+// attr values are always written in double quotes, so compact output leaves single quotes and '>' unescaped
+template <class Out>
+static void write_attr(Out& writer, std::string_view name, std::string_view value) {
+    writer.write(name);
+    writer.write("=\"");
+    if (writer.style == OutputStyle::Compact)
+        write_escaped<'"', '<', '&'>(writer, value);
+    else
+        write_escaped<'"', '\'', '<', '>', '&'>(writer, value);
+    writer.put('"');
 }
 
-std::ostream& xtree::operator<<(std::ostream& os, const Cmnt& cmnt) {
-    os << "<!-- " << cmnt.data << " --> ";
-    return os;
+template <class Out>
+static void write_attrs(Out& writer, const std::vector<Attr>& attrs) {
+    for (size_t i = 0; i < attrs.size(); i++) {
+        writer.put(' ');
+        write_attr(writer, attrs[i].name, attrs[i].value);
+    }
 }
 
-std::ostream& xtree::operator<<(std::ostream& os, const Dtd& dtd) {
-    os << "<!DOCTYPE " << dtd.data << "> ";
-    return os;
+template <class Out>
+static void write_text(Out& writer, std::string_view data) {
+    if (writer.style == OutputStyle::Compact)
+        write_escaped<'<', '>', '&'>(writer, data);
+    else
+        write_escaped<'"', '\'', '<', '>', '&'>(writer, data);
+    write_pad(writer);
 }
 
-std::ostream& xtree::operator<<(std::ostream& os, const Node& node) {
-    if (auto elem_ptr = std::get_if<std::unique_ptr<Elem>>(&node.data))
-        os << **elem_ptr;
-    else if (auto text = std::get_if<Text>(&node.data))
-        os << *text;
-    else if (auto cmnt = std::get_if<Cmnt>(&node.data))
-        os << *cmnt;
-    return os;
+// the parser trims the spaces around a comment, so compact output leaves them out
+template <class Out>
+static void write_cmnt(Out& writer, std::string_view data) {
+    if (writer.style == OutputStyle::Compact) {
+        writer.write("<!--");
+        writer.write(data);
+        writer.write("-->");
+        return;
+    }
+    writer.write("<!-- ");
+    writer.write(data);
+    writer.write(" --> ");
 }
 
-std::ostream& xtree::operator<<(std::ostream& os, const BaseNode& node) {
-    if (auto text = std::get_if<Decl>(&node.data))
-        os << *text;
-    else if (auto decl = std::get_if<Cmnt>(&node.data))
-        os << *decl;
-    else if (auto dtd = std::get_if<Dtd>(&node.data))
-        os << *dtd;
-    return os;
+template <class Out>
+static void write_dtd(Out& writer, std::string_view data) {
+    writer.write("<!DOCTYPE ");
+    writer.write(data);
+    writer.put('>');
+    write_pad(writer);
+}
+
+template <class Out>
+static void write_decl(Out& writer, const Decl& decl) {
+    writer.write("<?");
+    writer.write(decl.tag);
+    write_attrs(writer, decl.attrs);
+    writer.write("?>");
+    write_pad(writer);
 }
 
 struct PrintFrame {
@@ -1277,7 +4103,25 @@ struct PrintFrame {
     size_t i;
 };
 
-std::ostream& xtree::operator<<(std::ostream& os, const Elem& elem) {
+template <class Out>
+static void write_open_tag(Out& writer, const Elem& elem) {
+    writer.put('<');
+    writer.write(elem.tag);
+    write_attrs(writer, elem.attrs);
+    writer.put('>');
+    write_pad(writer);
+}
+
+template <class Out>
+static void write_close_tag(Out& writer, const Elem& elem) {
+    writer.write("</");
+    writer.write(elem.tag);
+    writer.put('>');
+    write_pad(writer);
+}
+
+template <class Out>
+static void write_elem(Out& writer, const Elem& elem) {
     std::stack<PrintFrame> stack;
     stack.emplace(&elem, 0);
 
@@ -1285,17 +4129,8 @@ std::ostream& xtree::operator<<(std::ostream& os, const Elem& elem) {
         PrintFrame& top = stack.top();
 
         auto curr = top.ptr;
-        if (top.i == 0) {
-            os << "<" << curr->tag;
-            for (size_t i = 0; i < curr->attrs.size(); i++) {
-                if (i == 0)
-                    os << " ";
-                os << curr->attrs[i];
-                if (i < curr->attrs.size() - 1)
-                    os << " ";
-            }
-            os << "> ";
-        }
+        if (top.i == 0)
+            write_open_tag(writer, *curr);
 
         if (top.i < curr->children.size()) {
             auto& child = curr->children[top.i++];
@@ -1304,20 +4139,316 @@ std::ostream& xtree::operator<<(std::ostream& os, const Elem& elem) {
                 stack.emplace(elem_child, 0);
             }
             else if (child.is_text()) {
-                os << child.as_text();
+                write_text(writer, child.as_text().data);
             }
             else if (child.is_cmnt()) {
-                os << child.as_cmnt();
+                write_cmnt(writer, child.as_cmnt().data);
             }
             else {
                 throw std::runtime_error("unknown variant case");
             }
         }
         else {
-            os << "</" << curr->tag << "> ";
+            write_close_tag(writer, *curr);
             stack.pop();
         }
     }
+}
+
+template <class Out>
+static void write_node(Out& writer, const Node& node) {
+    if (auto elem_ptr = std::get_if<std::unique_ptr<Elem>>(&node.data))
+        write_elem(writer, **elem_ptr);
+    else if (auto text = std::get_if<Text>(&node.data))
+        write_text(writer, text->data);
+    else if (auto cmnt = std::get_if<Cmnt>(&node.data))
+        write_cmnt(writer, cmnt->data);
+}
+
+template <class Out>
+static void write_base_node(Out& writer, const BaseNode& node) {
+    if (auto decl = std::get_if<Decl>(&node.data))
+        write_decl(writer, *decl);
+    else if (auto cmnt = std::get_if<Cmnt>(&node.data))
+        write_cmnt(writer, cmnt->data);
+    else if (auto dtd = std::get_if<Dtd>(&node.data))
+        write_dtd(writer, dtd->data);
+}
+
+template <class Out>
+static void write_document(Out& writer, const Document& document) {
+    for (auto& node: document.children)
+        write_base_node(writer, node);
+    if (document.root != nullptr)
+        write_elem(writer, *document.root);
+}
+
+// writes the output of write into a string in a single pass
+template <class Write>
+static std::string serialize_string(const Write& write, OutputStyle style) {
+    std::string str;
+    Writer writer(str, style);
+    write(writer);
+    writer.flush();
+    return str;
+}
+
+// writes the output of write into the buffer if it fits, returns the size of the output either way
+template <class Write>
+static size_t serialize_sized_to(const Write& write, char* buffer, size_t size, OutputStyle style) {
+    SizeCounter counter{style};
+    write(counter);
+
+    if (counter.size > 0 && counter.size <= size) {
+        BufferWriter writer{style, buffer};
+        write(writer);
+    }
+    return counter.size;
+}
+
+std::string Document::serialize(OutputStyle style) const {
+    return serialize_string([this](auto& writer) { write_document(writer, *this); }, style);
+}
+
+size_t Document::serialize_to(char* buffer, size_t size, OutputStyle style) const {
+    return serialize_sized_to([this](auto& writer) { write_document(writer, *this); }, buffer, size, style);
+}
+
+void Document::write(int fd, OutputStyle style) const {
+    Writer writer(fd, style);
+    write_document(writer, *this);
+    writer.flush();
+}
+
+std::string Document::serialize_parallel(size_t thread_count, OutputStyle style) const {
+    // a range with fewer children than this is written faster than a thread can be started to write it
+    constexpr size_t MIN_RANGE_CHILDREN = 1024;
+
+    if (thread_count == 0)
+        thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+
+    // the ranges are taken from the first elem with more than one child, the elems enclosing it are written around them
+    std::vector<const Elem*> chain;
+    for (auto elem = root.get(); elem != nullptr;) {
+        chain.push_back(elem);
+        auto& elem_children = elem->children;
+        elem = elem_children.size() == 1 && elem_children[0].is_elem() ? &elem_children[0].as_elem() : nullptr;
+    }
+    if (chain.empty())
+        return serialize(style);
+
+    auto& range_children = chain.back()->children;
+    size_t ranges_count = std::min(thread_count, range_children.size() / MIN_RANGE_CHILDREN);
+    if (ranges_count < 2)
+        return serialize(style);
+
+    auto write_head = [&](auto& writer) {
+        for (auto& node: children)
+            write_base_node(writer, node);
+        for (auto elem: chain)
+            write_open_tag(writer, *elem);
+    };
+    auto write_tail = [&](auto& writer) {
+        for (auto it = chain.rbegin(); it != chain.rend(); it++)
+            write_close_tag(writer, **it);
+    };
+    auto write_range = [&](auto& writer, size_t i) {
+        size_t begin = range_children.size() * i / ranges_count;
+        size_t end = range_children.size() * (i + 1) / ranges_count;
+        for (size_t j = begin; j < end; j++)
+            write_node(writer, range_children[j]);
+    };
+
+    // every range is sized on its own thread, so that each can then be written at its exact offset in a single string
+    std::vector<SizeCounter> counters(ranges_count, SizeCounter{style});
+    run_on_threads(ranges_count, [&](size_t i) { write_range(counters[i], i); });
+
+    SizeCounter head{style};
+    write_head(head);
+    std::vector<size_t> offsets{head.size};
+    for (auto& counter: counters)
+        offsets.push_back(offsets.back() + counter.size);
+    SizeCounter tail{style};
+    write_tail(tail);
+
+    std::string str(offsets.back() + tail.size, '\0');
+    BufferWriter head_writer{style, str.data()};
+    write_head(head_writer);
+    run_on_threads(ranges_count, [&](size_t i) {
+        BufferWriter writer{style, str.data() + offsets[i]};
+        write_range(writer, i);
+    });
+    BufferWriter tail_writer{style, str.data() + offsets.back()};
+    write_tail(tail_writer);
+    return str;
+}
+
+std::string Elem::serialize(OutputStyle style) const {
+    return serialize_string([this](auto& writer) { write_elem(writer, *this); }, style);
+}
+
+size_t Elem::serialize_to(char* buffer, size_t size, OutputStyle style) const {
+    return serialize_sized_to([this](auto& writer) { write_elem(writer, *this); }, buffer, size, style);
+}
+
+std::string Node::serialize(OutputStyle style) const {
+    return serialize_string([this](auto& writer) { write_node(writer, *this); }, style);
+}
+
+size_t Node::serialize_to(char* buffer, size_t size, OutputStyle style) const {
+    return serialize_sized_to([this](auto& writer) { write_node(writer, *this); }, buffer, size, style);
+}
+
+std::ostream& xtree::operator<<(std::ostream& os, const Attr& attr) {
+    Writer writer(os);
+    write_attr(writer, attr.name, attr.value);
+    writer.flush();
+    return os;
+}
+
+std::ostream& xtree::operator<<(std::ostream& os, const Text& text) {
+    Writer writer(os);
+    write_text(writer, text.data);
+    writer.flush();
+    return os;
+}
+
+std::ostream& xtree::operator<<(std::ostream& os, const Decl& decl) {
+    Writer writer(os);
+    write_decl(writer, decl);
+    writer.flush();
+    return os;
+}
+
+std::ostream& xtree::operator<<(std::ostream& os, const Document& document) {
+    Writer writer(os, Writer::BLOCK_SIZ);
+    write_document(writer, document);
+    writer.flush();
+    return os;
+}
+
+std::ostream& xtree::operator<<(std::ostream& os, const Cmnt& cmnt) {
+    Writer writer(os);
+    write_cmnt(writer, cmnt.data);
+    writer.flush();
+    return os;
+}
+
+std::ostream& xtree::operator<<(std::ostream& os, const Dtd& dtd) {
+    Writer writer(os);
+    write_dtd(writer, dtd.data);
+    writer.flush();
+    return os;
+}
+
+std::ostream& xtree::operator<<(std::ostream& os, const Node& node) {
+    Writer writer(os);
+    write_node(writer, node);
+    writer.flush();
+    return os;
+}
+
+std::ostream& xtree::operator<<(std::ostream& os, const BaseNode& node) {
+    Writer writer(os);
+    write_base_node(writer, node);
+    writer.flush();
+    return os;
+}
+
+std::ostream& xtree::operator<<(std::ostream& os, const Elem& elem) {
+    Writer writer(os);
+    write_elem(writer, elem);
+    writer.flush();
+    return os;
+}
+
+template <class Out>
+static void write_flat_attrs(Out& writer, const FlatDocument& document, const FlatNode& node) {
+    for (uint32_t i = 0; i < node.attrs_count; i++) {
+        auto& attr = document.attrs[node.attrs_begin + i];
+        writer.put(' ');
+        write_attr(writer, document.string(attr.name), document.string(attr.value));
+    }
+}
+
+// writes the same output as the equivalent Document, with the nodes outside the root written before it
+template <class Out>
+static void write_flat_document(Out& writer, const FlatDocument& document) {
+    auto& nodes = document.nodes;
+
+    for (uint32_t i = 0; i < nodes.size(); i = nodes[i].next_sibling) {
+        auto& node = nodes[i];
+        switch (node.kind) {
+        case FlatKind::Cmnt:
+            write_cmnt(writer, document.string(node.data));
+            break;
+        case FlatKind::Dtd:
+            write_dtd(writer, document.string(node.data));
+            break;
+        case FlatKind::Decl:
+            writer.write("<?");
+            writer.write(document.string(node.data));
+            write_flat_attrs(writer, document, node);
+            writer.write("?>");
+            write_pad(writer);
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (document.root == FlatNode::NONE)
+        return;
+
+    // the root's subtree is written in a single pass over the array, closing elems once a node outside of them is reached
+    std::vector<uint32_t> stack;
+    auto close_elem = [&]() {
+        writer.write("</");
+        writer.write(document.string(nodes[stack.back()].data));
+        writer.put('>');
+        write_pad(writer);
+        stack.pop_back();
+    };
+
+    for (uint32_t i = document.root; i < nodes.size(); i++) {
+        auto& node = nodes[i];
+        if (i != document.root && node.parent == FlatNode::NONE)
+            break;
+
+        while (!stack.empty() && stack.back() != node.parent)
+            close_elem();
+
+        switch (node.kind) {
+        case FlatKind::Elem:
+            writer.put('<');
+            writer.write(document.string(node.data));
+            write_flat_attrs(writer, document, node);
+            writer.put('>');
+            write_pad(writer);
+            stack.push_back(i);
+            break;
+        case FlatKind::Text:
+            write_text(writer, document.string(node.data));
+            break;
+        case FlatKind::Cmnt:
+            write_cmnt(writer, document.string(node.data));
+            break;
+        default:
+            throw std::runtime_error("unknown variant case");
+        }
+    }
+
+    while (!stack.empty())
+        close_elem();
+}
+
+std::string FlatDocument::serialize(OutputStyle style) const {
+    return serialize_string([this](auto& writer) { write_flat_document(writer, *this); }, style);
+}
 
+std::ostream& xtree::operator<<(std::ostream& os, const FlatDocument& document) {
+    Writer writer(os, Writer::BLOCK_SIZ);
+    write_flat_document(writer, document);
+    writer.flush();
     return os;
 }
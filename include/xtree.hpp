@@ -2,10 +2,15 @@
 // 4/25/2024
 // Xml parsing library for C++
 
+#include <optional>
 #include <variant>
 #include <memory>
 #include <stack>
 #include <vector>
+#include <string>
+#include <string_view>
+#include <memory_resource>
+#include <cstdint>
 
 namespace xtree {
 
@@ -19,6 +24,77 @@ struct NodeWalkException : public std::runtime_error {
     }
 };
 
+enum class ParseError {
+    EndOfStream,
+    InvalidEscSeq,
+    InvalidTagname,
+    InvalidCloseTok,
+    InvalidOpenTok,
+    InvalidAttrList,
+    InvalidCloseDecl,
+    AttrValBegin,
+    UnclosedAttrsList,
+    CloseTagMismatch,
+    MultipleRoots,
+    InvalidRootOpenTok,
+    InvalidXmlMeta,
+};
+
+struct ParseException : public std::runtime_error {
+    ParseError code;
+    size_t offset; // the number of characters of the input before the error, the row and col in the message are computed from it
+
+    explicit ParseException(std::string& m, ParseError code, size_t offset = 0) : std::runtime_error(m), code(code), offset(offset) {
+#if DEBUG
+        fprintf(stderr, "Threw a parse exception %s: %d\n", m.c_str(), code);
+#endif
+    }
+};
+
+// the error of a parse that returned it instead of throwing a ParseException, the row and col are only counted when the message is formatted
+struct ParseFailure {
+    ParseError code = ParseError::EndOfStream;
+    size_t offset = 0; // the number of characters of the input before the error
+    std::string detail; // the message without the row and col
+    const char* input = nullptr; // the parsed buffer, which must outlive calls to message and exception
+
+    // the message the ParseException for this error would have
+    std::string message() const;
+
+    ParseException exception() const;
+};
+
+// either the parsed value or the failure that prevented it from being parsed, in the manner of std::expected
+template <class T>
+struct ParseResult {
+    std::variant<T, ParseFailure> data;
+
+    bool has_value() const {
+        return data.index() == 0;
+    }
+
+    explicit operator bool() const {
+        return has_value();
+    }
+
+    // throws the ParseException of the failure if the parse failed
+    T& value() {
+        if (auto value = std::get_if<T>(&data))
+            return *value;
+        throw std::get<ParseFailure>(data).exception();
+    }
+
+    const ParseFailure& error() const {
+        return std::get<ParseFailure>(data);
+    }
+};
+
+// how the serializer lays out its output
+enum class OutputStyle {
+    Padded, // a space after every node, with all five markup characters escaped everywhere
+    Compact, // no padding, escaping only the characters that would end the text or attr value they are in
+};
+
 struct Attr {
     std::string name;
     std::string value;
@@ -159,7 +235,9 @@ struct Node {
 
     Node& operator=(Node&& other) noexcept;
 
-    std::string serialize() const;
+    std::string serialize(OutputStyle style = OutputStyle::Padded) const;
+
+    size_t serialize_to(char* buffer, size_t size, OutputStyle style = OutputStyle::Padded) const;
 };
 
 bool operator==(const Node& node, const Node& other);
@@ -218,6 +296,9 @@ struct Elem {
 
     size_t normalize();
 
+    // releases the spare capacity of the attrs and children of this elem and every elem below it, in a single pass
+    void shrink_to_fit();
+
     Elem&& add_attr(std::string name, std::string value) && {
         attrs.emplace_back(std::move(name), std::move(value));
         return std::move(*this);
@@ -250,7 +331,9 @@ struct Elem {
 
     Elem& operator=(const Elem& other);
 
-    std::string serialize() const;
+    std::string serialize(OutputStyle style = OutputStyle::Padded) const;
+
+    size_t serialize_to(char* buffer, size_t size, OutputStyle style = OutputStyle::Padded) const;
 
     class iterator {
     private:
@@ -328,6 +411,13 @@ struct BaseNode {
 
 std::ostream& operator<<(std::ostream& os, const BaseNode& node);
 
+// how the parser sizes the node vectors of a document
+enum class CapacityPolicy {
+    Slack, // keep the spare capacity left by growing the vectors, which shrink_to_fit can release later
+    Compact, // shrink every vector in a single pass once the document has been parsed, reallocating each of them once more
+    Presize, // reserve the exact children count of each elem, counted by a structural pre-scan of the input, the fewest allocations
+};
+
 struct Document {
     std::vector<BaseNode> children;
     std::unique_ptr<Elem> root;
@@ -336,13 +426,25 @@ struct Document {
 
     Document(Document&&) = default;
 
-    static Document from_file(const std::string& file_path);
+    static Document from_file(const std::string& file_path, CapacityPolicy policy = CapacityPolicy::Presize);
+
+    // a stream cannot be scanned twice, so presizing keeps the slack
+    static Document from_file(std::ifstream& file, CapacityPolicy policy = CapacityPolicy::Presize);
+
+    static Document from_string(const std::string& str, CapacityPolicy policy = CapacityPolicy::Presize);
 
-    static Document from_file(std::ifstream& file);
+    static Document from_buffer(const char* buffer, size_t size, CapacityPolicy policy = CapacityPolicy::Presize);
 
-    static Document from_string(const std::string& str);
+    // returns a malformed document's error instead of throwing it, the buffer must outlive the failure's message
+    static ParseResult<Document> try_from_buffer(const char* buffer, size_t size, CapacityPolicy policy = CapacityPolicy::Presize);
 
-    static Document from_buffer(const char* buffer, size_t size);
+    static ParseResult<Document> try_from_string(const std::string& str, CapacityPolicy policy = CapacityPolicy::Presize);
+
+    // splits the root's content into fragments that are parsed on separate threads then joined, for large documents
+    // falls back to from_buffer when the document is too small or a fragment boundary was guessed wrong
+    // the fragments are not pre-scanned, so presizing keeps the slack
+    static Document from_buffer_parallel(const char* buffer, size_t size, size_t thread_count = 0,
+        CapacityPolicy policy = CapacityPolicy::Presize);
 
     static Document from_other(const Document& other);
 
@@ -381,6 +483,12 @@ struct Document {
         return 0;
     }
 
+    void shrink_to_fit() {
+        children.shrink_to_fit();
+        if (root != nullptr)
+            root->shrink_to_fit();
+    }
+
     void clear() {
         children.clear();
         root = nullptr;
@@ -388,7 +496,17 @@ struct Document {
 
     Document& operator=(const Document& other);
 
-    std::string serialize() const;
+    std::string serialize(OutputStyle style = OutputStyle::Padded) const;
+
+    // writes the serialized output into the buffer if it fits and returns its size, nothing is written if it does not fit
+    size_t serialize_to(char* buffer, size_t size, OutputStyle style = OutputStyle::Padded) const;
+
+    // writes the serialized document to the file descriptor in large blocks, without building the whole string first
+    void write(int fd, OutputStyle style = OutputStyle::Padded) const;
+
+    // splits the children of the first elem with more than one child into ranges that are serialized on separate threads
+    // straight into their offsets of the output, falls back to serialize when there are too few children to split
+    std::string serialize_parallel(size_t thread_count = 0, OutputStyle style = OutputStyle::Padded) const;
 
     class iterator {
     private:
@@ -453,30 +571,665 @@ bool operator==(const Document& document, const Document& other);
 
 std::ostream& operator<<(std::ostream& os, const Document& document);
 
-enum class ParseError {
-    EndOfStream,
-    InvalidEscSeq,
-    InvalidTagname,
-    InvalidCloseTok,
-    InvalidOpenTok,
-    InvalidAttrList,
-    InvalidCloseDecl,
-    AttrValBegin,
-    UnclosedAttrsList,
-    CloseTagMismatch,
-    MultipleRoots,
-    InvalidRootOpenTok,
-    InvalidXmlMeta,
+// a tag or attr name interned in the symbol table, so names can be compared by id rather than by their characters
+struct Symbol {
+    uint32_t id = 0; // names that were not interned have the empty symbol
+
+    std::string_view name() const;
+
+    friend bool operator==(Symbol symbol, Symbol other) = default;
 };
 
-struct ParseException : public std::runtime_error {
-    ParseError code;
+// the table of names interned by the process, which is shared by every document and safe to use from several threads at once
+// an interned name is stored once and never released, so its view remains valid for the lifetime of the process
+struct SymbolTable {
+    static Symbol intern(std::string_view name);
 
-    explicit ParseException(std::string& m, ParseError code) : std::runtime_error(m), code(code) {
-#if DEBUG
-        fprintf(stderr, "Threw a parse exception %s: %d\n", m.c_str(), code);
-#endif
+    // the symbol of a name that was already interned, without interning it
+    static std::optional<Symbol> find(std::string_view name);
+
+    static std::string_view name(Symbol symbol);
+
+    // the number of interned names, including the empty symbol
+    static size_t size();
+};
+
+// The view types mirror the owning node types, but their strings borrow from the input buffer the document was parsed from.
+// Strings are only copied (into storage owned by the DocumentView) when decoding an escape or merging cdata changes the characters.
+// When parsed with interned names, the tag and attr names instead point into the symbol table and carry their symbol.
+
+struct AttrView {
+    std::string_view name;
+    std::string_view value;
+    Symbol symbol;
+
+    friend bool operator==(const AttrView& attr, const AttrView& other) {
+        return attr.name == other.name && attr.value == other.value;
+    }
+};
+
+struct TextView {
+    std::string_view data;
+
+    friend bool operator==(const TextView& lhs, const TextView& rhs) = default;
+};
+
+struct CmntView {
+    std::string_view data;
+
+    friend bool operator==(const CmntView& cmnt, const CmntView& other) = default;
+};
+
+struct DtdView {
+    std::string_view data;
+
+    friend bool operator==(const DtdView& dtd, const DtdView& other) = default;
+};
+
+struct DeclView {
+    std::string_view tag;
+    std::vector<AttrView> attrs;
+
+    const AttrView* select_attr(std::string_view attr_name) const {
+        for (auto& attr: attrs)
+            if (attr.name == attr_name)
+                return &attr;
+        return nullptr;
+    }
+
+    friend bool operator==(const DeclView& decl, const DeclView& other) = default;
+};
+
+struct ElemView;
+
+using NodeViewVariant = std::variant<ElemView*, CmntView, TextView>; // invariant: ElemView cannot point to a null
+
+struct NodeView {
+    NodeViewVariant data;
+
+    explicit NodeView(NodeViewVariant data) : data(data) {}
+
+    bool is_cmnt() const {
+        return holds_alternative<CmntView>(data);
+    }
+
+    bool is_text() const {
+        return holds_alternative<TextView>(data);
+    }
+
+    bool is_elem() const {
+        return holds_alternative<ElemView*>(data);
+    }
+
+    const CmntView& as_cmnt() const {
+        if (auto node = std::get_if<CmntView>(&data))
+            return *node;
+        throw NodeWalkException("node is not a comment type node");
+    }
+
+    const TextView& as_text() const {
+        if (auto node = std::get_if<TextView>(&data))
+            return *node;
+        throw NodeWalkException("node is not a data type node");
+    }
+
+    const ElemView& as_elem() const {
+        if (auto elem_ptr = std::get_if<ElemView*>(&data))
+            return **elem_ptr;
+        throw NodeWalkException("node is not an elem type node");
+    }
+};
+
+struct ElemView {
+    std::string_view tag;
+    std::pmr::vector<AttrView> attrs;
+    std::pmr::vector<NodeView> children;
+    Symbol symbol;
+
+    ElemView(std::string_view tag, std::pmr::memory_resource* resource) : tag(tag), attrs(resource), children(resource) {}
+
+    const ElemView* select_elem(std::string_view ctag) const;
+
+    const AttrView* select_attr(std::string_view attr_name) const;
+
+    const ElemView& expect_elem(std::string_view ctag) const;
+
+    const AttrView& expect_attr(std::string_view attr_name) const;
+
+    // the symbol overloads compare ids, so they only find the nodes of a document parsed with interned names
+    const ElemView* select_elem(Symbol ctag) const;
+
+    const AttrView* select_attr(Symbol attr_name) const;
+
+    const ElemView& expect_elem(Symbol ctag) const;
+
+    const AttrView& expect_attr(Symbol attr_name) const;
+
+    const NodeView& nth_child(size_t i) const {
+        if (i >= children.size())
+            throw NodeWalkException(std::to_string(i) + "th child is out of bounds");
+        return children[i];
+    }
+
+    const AttrView& nth_attr(size_t i) const {
+        if (i >= attrs.size())
+            throw NodeWalkException(std::to_string(i) + "th attr is out of bounds");
+        return attrs[i];
+    }
+
+    // copies the elem and its subtree into owning nodes, which remain valid after the document view is destroyed
+    Elem to_elem() const;
+
+    std::pmr::vector<NodeView>::const_iterator begin() const {
+        return children.begin();
+    }
+
+    std::pmr::vector<NodeView>::const_iterator end() const {
+        return children.end();
+    }
+};
+
+using BaseViewVariant = std::variant<CmntView, DeclView, DtdView>;
+
+struct BaseNodeView {
+    BaseViewVariant data;
+
+    bool is_cmnt() const {
+        return std::holds_alternative<CmntView>(data);
+    }
+
+    bool is_decl() const {
+        return std::holds_alternative<DeclView>(data);
+    }
+
+    bool is_dtd() const {
+        return std::holds_alternative<DtdView>(data);
+    }
+
+    const CmntView& as_cmnt() const {
+        if (auto node = std::get_if<CmntView>(&data))
+            return *node;
+        throw NodeWalkException("node is not a comment type node");
+    }
+
+    const DeclView& as_decl() const {
+        if (auto node = std::get_if<DeclView>(&data))
+            return *node;
+        throw NodeWalkException("node is not a decl type node");
+    }
+
+    const DtdView& as_dtd() const {
+        if (auto node = std::get_if<DtdView>(&data))
+            return *node;
+        throw NodeWalkException("node is not a decl type node");
+    }
+};
+
+// a monotonic arena that releases everything allocated from it at once, and counts how many bytes were allocated
+struct Arena : public std::pmr::monotonic_buffer_resource {
+    static constexpr size_t MIN_BLOCK_SIZ = 4096;
+
+    size_t allocated = 0;
+
+    explicit Arena(size_t initial_size) : std::pmr::monotonic_buffer_resource(initial_size) {}
+
+protected:
+    void* do_allocate(size_t bytes, size_t alignment) override;
+};
+
+// a read-only document whose strings borrow from the buffer it was parsed from, so the buffer must outlive the document
+// every elem is allocated from the document's arena and never destroyed individually, so destroying the document is a single release
+// nodes cannot outlive the document, but can be copied out with to_elem or to_document
+struct DocumentView {
+    std::vector<BaseNodeView> children;
+    ElemView* root = nullptr;
+
+    std::unique_ptr<Arena> arena; // backs the elems, their attr and child vectors, and the strings that could not be borrowed
+    std::shared_ptr<const void> source; // keeps the input alive when the document owns it, such as a mapped file
+
+    // the arena's first block is an eighth of the input and grows from there, the tree measured between 0.4 and 4 times the input
+    explicit DocumentView(size_t input_size = 0);
+
+    DocumentView(DocumentView&&) = default;
+
+    DocumentView(const DocumentView&) = delete;
+
+    DocumentView& operator=(DocumentView&&) = default;
+
+    static DocumentView from_buffer(const char* buffer, size_t size);
+
+    // returns a malformed document's error instead of throwing it
+    static ParseResult<DocumentView> try_from_buffer(const char* buffer, size_t size);
+
+    // interns every tag and attr name in the symbol table, so names are stored once per process and can be compared by symbol
+    static DocumentView from_buffer_interned(const char* buffer, size_t size);
+
+    // parses destructively, decoding escapes and cdata over the buffer's own characters so no strings need to be copied
+    // the buffer's contents are unspecified after parsing, other than the ranges the document's strings point to
+    static DocumentView from_mutable_buffer(char* buffer, size_t size);
+
+    // maps (or reads) the file and keeps it alive for as long as the document
+    static DocumentView from_file(const std::string& file_path);
+
+    const DeclView* select_decl(std::string_view tag) const {
+        for (auto& child: children)
+            if (auto decl = get_if<DeclView>(&child.data))
+                if (decl->tag == tag)
+                    return decl;
+        return nullptr;
+    }
+
+    const ElemView& expect_root() const {
+        if (root != nullptr) {
+            return *root;
+        }
+        throw NodeWalkException("document does not contain a root element");
+    }
+
+    // copies the document into owning nodes, which remain valid after the document view and its buffer are destroyed
+    Document to_document() const;
+
+    // releases the entire tree at once
+    void clear();
+
+    std::vector<BaseNodeView>::const_iterator begin() const {
+        return children.begin();
+    }
+
+    std::vector<BaseNodeView>::const_iterator end() const {
+        return children.end();
+    }
+};
+
+Docstats stat_document(const DocumentView& document);
+
+// receives the nodes of a document in order as they are parsed, without a tree ever being built
+// an elem without children still receives an on_open followed by an on_close, and views are only valid for the duration of the call
+struct SaxHandler {
+    virtual ~SaxHandler() = default;
+
+    virtual void on_decl(std::string_view, const std::vector<AttrView>&) {}
+
+    virtual void on_dtd(std::string_view) {}
+
+    virtual void on_open(std::string_view, const std::vector<AttrView>&) {}
+
+    virtual void on_close(std::string_view) {}
+
+    virtual void on_text(std::string_view) {}
+
+    virtual void on_cmnt(std::string_view) {}
+};
+
+// parses a document and emits its nodes to the handler, using memory proportional to the depth of the document rather than its size
+void sax_from_buffer(const char* buffer, size_t size, SaxHandler& handler);
+
+void sax_from_file(const std::string& file_path, SaxHandler& handler);
+
+void sax_from_stream(std::istream& stream, SaxHandler& handler);
+
+// checks that the buffer is a document the parsers accept without building anything, returns the failure if it is malformed
+// only the names of the open elems are kept, as views into the buffer, so memory is proportional to the depth of the document
+std::optional<ParseFailure> validate(const char* buffer, size_t size);
+
+enum class NodeKind {
+    Decl,
+    Dtd,
+    Open,
+    Close,
+    Text,
+    Cmnt,
+    End,
+};
+
+struct ReaderState;
+
+// a cursor that parses one node of a document each time next is called, so callers can pull only the nodes they need
+// the name, attrs and text of the current node are views that are only valid until the next call to next or skip_subtree
+struct XmlReader {
+    std::unique_ptr<ReaderState> state;
+
+    // the buffer must outlive the reader
+    XmlReader(const char* buffer, size_t size);
+
+    XmlReader(XmlReader&&) noexcept;
+
+    ~XmlReader();
+
+    // maps (or reads) the file and keeps it alive for as long as the reader
+    static XmlReader from_file(const std::string& file_path);
+
+    // advances to the next node and returns its kind, which is End once the whole document has been read
+    NodeKind next();
+
+    NodeKind kind() const;
+
+    // the tag of an Open, Close or Decl node
+    std::string_view name() const;
+
+    // the attrs of an Open or Decl node
+    const std::vector<AttrView>& attrs() const;
+
+    const AttrView* select_attr(std::string_view attr_name) const;
+
+    // the data of a Text, Cmnt or Dtd node
+    std::string_view text() const;
+
+    // the number of elems that are open, including the current one if it is an Open node
+    size_t depth() const;
+
+    // when on an Open node, skips the elem's children and stops on its Close node
+    void skip_subtree();
+};
+
+struct PushState;
+
+// a parser that is fed a document in chunks as they arrive, building the tree from every complete node as soon as it is fed
+// a chunk may end anywhere, including in the middle of a tag or escape sequence
+struct PushParser {
+    std::unique_ptr<PushState> state;
+
+    PushParser();
+
+    PushParser(PushParser&&) noexcept;
+
+    ~PushParser();
+
+    // parses the nodes completed by the chunk, throws a ParseException as soon as the fed input is malformed
+    void feed(const char* chunk, size_t size);
+
+    // parses the rest of the fed input as the end of the document and returns it, the parser is empty afterwards
+    Document finish();
+};
+
+struct LazyIndex;
+struct LazyElem;
+
+using LazyNodeVariant = std::variant<LazyElem*, CmntView, TextView>; // invariant: LazyElem cannot point to a null
+
+struct LazyNode {
+    LazyNodeVariant data;
+
+    explicit LazyNode(LazyNodeVariant data) : data(data) {}
+
+    bool is_cmnt() const {
+        return holds_alternative<CmntView>(data);
+    }
+
+    bool is_text() const {
+        return holds_alternative<TextView>(data);
+    }
+
+    bool is_elem() const {
+        return holds_alternative<LazyElem*>(data);
+    }
+
+    const CmntView& as_cmnt() const {
+        if (auto node = std::get_if<CmntView>(&data))
+            return *node;
+        throw NodeWalkException("node is not a comment type node");
+    }
+
+    const TextView& as_text() const {
+        if (auto node = std::get_if<TextView>(&data))
+            return *node;
+        throw NodeWalkException("node is not a data type node");
+    }
+
+    LazyElem& as_elem() const {
+        if (auto elem_ptr = std::get_if<LazyElem*>(&data))
+            return **elem_ptr;
+        throw NodeWalkException("node is not an elem type node");
     }
 };
 
+// an elem of a lazy document, whose tag and attrs are parsed the first time either is accessed, and whose children the first time they are accessed
+// parsing may throw a ParseException for malformed content the index pass did not check
+struct LazyElem {
+    LazyIndex* index;
+    size_t span; // the position of the elem's byte ranges in the index
+
+    bool tag_parsed = false;
+    bool children_parsed = false;
+    std::string_view parsed_tag;
+    std::pmr::vector<AttrView> parsed_attrs;
+    std::pmr::vector<LazyNode> parsed_children;
+
+    LazyElem(LazyIndex* index, size_t span, std::pmr::memory_resource* resource)
+        : index(index), span(span), parsed_attrs(resource), parsed_children(resource) {}
+
+    std::string_view tag();
+
+    const std::pmr::vector<AttrView>& attrs();
+
+    const std::pmr::vector<LazyNode>& children();
+
+    LazyElem* select_elem(std::string_view ctag);
+
+    const AttrView* select_attr(std::string_view attr_name);
+
+    LazyElem& expect_elem(std::string_view ctag);
+
+    const AttrView& expect_attr(std::string_view attr_name);
+
+    // parses the elem's entire subtree and copies it into owning nodes
+    Elem to_elem();
+
+    std::pmr::vector<LazyNode>::const_iterator begin() {
+        return children().begin();
+    }
+
+    std::pmr::vector<LazyNode>::const_iterator end() {
+        return children().end();
+    }
+};
+
+// a read-only document that is only indexed up front, recording the byte ranges and nesting of every elem in a single pass over the markup
+// elems are parsed as they are accessed, so a query that touches a few branches of a large document never parses the rest
+// like a document view its strings borrow from the buffer it was indexed from, which must outlive it, and it must not be accessed from several threads at once
+struct LazyDocument {
+    std::vector<BaseNodeView> children;
+    LazyElem* root = nullptr;
+
+    std::unique_ptr<LazyIndex> index; // the elems' byte ranges, the input and the arena the parsed elems are allocated from
+
+    LazyDocument();
+
+    LazyDocument(LazyDocument&&) noexcept;
+
+    LazyDocument& operator=(LazyDocument&&) noexcept;
+
+    ~LazyDocument();
+
+    static LazyDocument from_buffer(const char* buffer, size_t size);
+
+    // maps (or reads) the file and keeps it alive for as long as the document
+    static LazyDocument from_file(const std::string& file_path);
+
+    const DeclView* select_decl(std::string_view tag) const {
+        for (auto& child: children)
+            if (auto decl = get_if<DeclView>(&child.data))
+                if (decl->tag == tag)
+                    return decl;
+        return nullptr;
+    }
+
+    LazyElem& expect_root() const {
+        if (root != nullptr) {
+            return *root;
+        }
+        throw NodeWalkException("document does not contain a root element");
+    }
+
+    // parses the entire document and copies it into owning nodes
+    Document to_document() const;
+
+    std::vector<BaseNodeView>::const_iterator begin() const {
+        return children.begin();
+    }
+
+    std::vector<BaseNodeView>::const_iterator end() const {
+        return children.end();
+    }
+};
+
+enum class FlatKind : uint8_t {
+    Elem,
+    Text,
+    Cmnt,
+    Decl,
+    Dtd,
+};
+
+// a string stored in the string pool of a flat document
+struct FlatString {
+    size_t offset = 0;
+    size_t size = 0;
+};
+
+struct FlatAttr {
+    FlatString name;
+    FlatString value;
+};
+
+// a node of a flat document, which refers to its relatives by their positions in the document's nodes
+struct FlatNode {
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    FlatKind kind;
+    uint32_t parent = NONE; // nodes outside the root have no parent, and are siblings of the root
+    uint32_t first_child = NONE;
+    uint32_t next_sibling = NONE;
+    uint32_t attrs_begin = 0; // the position of the first attr in the document's attrs
+    uint32_t attrs_count = 0;
+    FlatString data; // the tag of an elem or decl, otherwise the node's data
+};
+
+struct FlatDocument;
+struct FlatElem;
+
+// a handle to a node of a flat document that mirrors Node, which is only valid for as long as the document
+struct FlatNodeRef {
+    const FlatDocument* document;
+    uint32_t index;
+
+    const FlatNode& node() const;
+
+    bool is_elem() const {
+        return node().kind == FlatKind::Elem;
+    }
+
+    bool is_text() const {
+        return node().kind == FlatKind::Text;
+    }
+
+    bool is_cmnt() const {
+        return node().kind == FlatKind::Cmnt;
+    }
+
+    FlatElem as_elem() const;
+
+    TextView as_text() const;
+
+    CmntView as_cmnt() const;
+};
+
+// iterates over the children of an elem of a flat document by following their sibling links
+struct FlatChildIterator {
+    const FlatDocument* document;
+    uint32_t index;
+
+    FlatNodeRef operator*() const {
+        return {document, index};
+    }
+
+    FlatChildIterator& operator++();
+
+    friend bool operator==(const FlatChildIterator& it, const FlatChildIterator& other) = default;
+};
+
+// a handle to an elem of a flat document that mirrors Elem, which is only valid for as long as the document
+struct FlatElem {
+    const FlatDocument* document;
+    uint32_t index;
+
+    const FlatNode& node() const;
+
+    std::string_view tag() const;
+
+    size_t attrs_count() const {
+        return node().attrs_count;
+    }
+
+    AttrView nth_attr(size_t i) const;
+
+    std::optional<AttrView> select_attr(std::string_view attr_name) const;
+
+    AttrView expect_attr(std::string_view attr_name) const;
+
+    std::optional<FlatElem> select_elem(std::string_view ctag) const;
+
+    FlatElem expect_elem(std::string_view ctag) const;
+
+    FlatNodeRef nth_child(size_t i) const;
+
+    // copies the elem and its subtree into owning nodes
+    Elem to_elem() const;
+
+    FlatChildIterator begin() const {
+        return {document, node().first_child};
+    }
+
+    FlatChildIterator end() const {
+        return {document, FlatNode::NONE};
+    }
+};
+
+// a document stored as a single array of nodes in document order, with every string in a single pool
+// a subtree is a contiguous range of the array, so walking, comparing and printing the document reads memory front to back
+struct FlatDocument {
+    std::vector<FlatNode> nodes;
+    std::vector<FlatAttr> attrs;
+    std::string strings;
+    uint32_t root = FlatNode::NONE;
+
+    static FlatDocument from_buffer(const char* buffer, size_t size);
+
+    static FlatDocument from_string(const std::string& str) {
+        return from_buffer(str.data(), str.size());
+    }
+
+    static FlatDocument from_file(const std::string& file_path);
+
+    std::string_view string(FlatString str) const {
+        return std::string_view(strings).substr(str.offset, str.size);
+    }
+
+    FlatElem expect_root() const {
+        if (root != FlatNode::NONE) {
+            return {this, root};
+        }
+        throw NodeWalkException("document does not contain a root element");
+    }
+
+    // copies the document into owning nodes
+    Document to_document() const;
+
+    std::string serialize(OutputStyle style = OutputStyle::Padded) const;
+};
+
+// calls on_node with every node of the document in document order, including the nodes outside the root
+template<typename F>
+void walk_document(const FlatDocument& document, const F& on_node) {
+    for (uint32_t i = 0; i < document.nodes.size(); i++) {
+        on_node(FlatNodeRef{&document, i});
+    }
+}
+
+Docstats stat_document(const FlatDocument& document);
+
+bool operator==(const FlatDocument& document, const FlatDocument& other);
+
+std::ostream& operator<<(std::ostream& os, const FlatDocument& document);
+
 }
\ No newline at end of file
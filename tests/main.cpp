@@ -2,10 +2,14 @@
 // 4/28/2024
 // Tests for parser
 
+#include <atomic>
 #include <chrono>
 #include <cstring>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
+#include <thread>
 #include "../include/xtree.hpp"
 
 void fail_test(const std::string& expected, const std::string& actual) {
@@ -86,6 +90,41 @@ void test_escseq() {
     }
 }
 
+void test_char_refs() {
+    std::string str = "<Test href=\"a?b=1&amp;c=&#50;\">&#65;&#x42; &#xe9;&#x4E16;&#128512;</Test>";
+
+    xtree::Document expected;
+    auto root = xtree::Elem("Test")
+        .add_attr("href", "a?b=1&c=2")
+        .add_node(xtree::Text("AB é世😀"));
+    expected.add_root(std::move(root));
+
+    auto document = xtree::Document::from_string(str);
+    if (expected != document) {
+        fail_test(expected.serialize(), document.serialize());
+    }
+
+    // decoding in place writes the utf-8 bytes over the reference they were decoded from
+    std::string buffer = str;
+    auto view = xtree::DocumentView::from_mutable_buffer(buffer.data(), buffer.size());
+    if (view.to_document() != expected) {
+        fail_test(expected.serialize(), view.to_document().serialize());
+    }
+
+    // references to characters that are not allowed in xml, or that are malformed, are invalid escapes
+    for (auto invalid: {"&#0;", "&#xD800;", "&#x110000;", "&#;", "&#x;", "&#12a;", "&#x000000041;", "&#X41;", "&lg;"}) {
+        auto invalid_str = std::string("<Test>") + invalid + "</Test>";
+        try {
+            xtree::Document::from_string(invalid_str);
+            fail_test("invalid esc sequence exception", "no exception");
+        } catch (xtree::ParseException& ex) {
+            if (ex.code != xtree::ParseError::InvalidEscSeq) {
+                fail_test("invalid esc sequence exception", ex.what());
+            }
+        }
+    }
+}
+
 void test_dtd() {
     auto str =
         "<!DOCTYPE hello testing123 hello  >"
@@ -145,6 +184,538 @@ void test_begin_cdata() {
     }
 }
 
+void test_cdata_brackets() {
+    auto str = "<Test><![CDATA[a]b]]c]]]]><![CDATA[]]></Test>";
+
+    auto document = xtree::Document::from_string(str);
+
+    xtree::Document expected;
+    auto root = xtree::Elem("Test").add_node(xtree::Text("a]b]]c]]"));
+    expected.add_root(std::move(root));
+
+    if (expected != document) {
+        fail_test(expected.serialize(), document.serialize());
+    }
+}
+
+void test_long_text() {
+    std::string text;
+    for (int i = 0; i < 20; i++)
+        text += "The quick brown fox jumps over the lazy dog &amp; ";
+    auto str = "<Test>\n" + text + "<![CDATA[<ok>]]></Test>";
+
+    auto document = xtree::Document::from_string(str);
+
+    std::string expected_text;
+    for (int i = 0; i < 20; i++)
+        expected_text += "The quick brown fox jumps over the lazy dog & ";
+    expected_text += "<ok>";
+
+    xtree::Document expected;
+    auto root = xtree::Elem("Test").add_node(xtree::Text(expected_text));
+    expected.add_root(std::move(root));
+
+    if (expected != document) {
+        fail_test(expected.serialize(), document.serialize());
+    }
+}
+
+void test_error_position() {
+    try {
+        auto str = "<Test>\nSome text\nspanning lines </Test1>";
+        auto document = xtree::Document::from_string(str);
+        fprintf(stderr, "Expected document parse to throw an exception\n");
+    }
+    catch (xtree::ParseException& ex) {
+        std::string message = ex.what();
+        if (message.find("at row: 3, col: 23") == std::string::npos) {
+            fail_test("error at row: 3, col: 23", message);
+        }
+        if (ex.offset != 39) {
+            fail_test("error at offset 39", std::to_string(ex.offset));
+        }
+    }
+
+    // errors are located the same when parsing a stream, including right after the stream's buffer is refilled
+    for (size_t shift = 0; shift < 24; shift++) {
+        std::string str = "<Test>\n";
+        while (str.size() < 64 * 1024 - 12 + shift)
+            str += "Some text\n";
+        str += "</Test1>";
+
+        std::string expected;
+        std::string actual;
+        try {
+            xtree::Document::from_string(str);
+        } catch (xtree::ParseException& ex) {
+            expected = ex.what();
+        }
+        try {
+            std::istringstream stream(str);
+            xtree::SaxHandler handler;
+            xtree::sax_from_stream(stream, handler);
+        } catch (xtree::ParseException& ex) {
+            actual = ex.what();
+        }
+        if (expected.empty() || expected != actual) {
+            fail_test(expected, actual);
+        }
+    }
+}
+
+// builds a document of count Record elems under a Records root, each with the attrs given and the content returned for its index
+template <class Content>
+std::string records_document(int count, const std::string& attrs, const Content& content) {
+    std::string str = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<Records>\n";
+    for (int i = 0; i < count; i++)
+        str += "<Record Id=\"" + std::to_string(i) + "\"" + attrs + ">" + content(i) + "</Record>\n";
+    str += "</Records>\n";
+    return str;
+}
+
+void test_large_file() {
+    auto str = records_document(5000, " Kind=\"a &amp; b\"", [](int i) {
+        return "\n  <Name>Record number " + std::to_string(i) + " &lt;text&gt;</Name>\n"
+            "  <!-- comment for record " + std::to_string(i) + " -->\n"
+            "  <Data><![CDATA[raw <data> ]] here]]></Data>\n";
+    });
+
+    auto file_path = "test_large_file.xml";
+    {
+        std::ofstream out(file_path);
+        out << str;
+    }
+
+    auto expected = xtree::Document::from_string(str);
+    auto document = xtree::Document::from_file(file_path);
+
+    std::ifstream file(file_path);
+    auto stream_document = xtree::Document::from_file(file);
+    file.close();
+    std::remove(file_path);
+
+    if (expected != document) {
+        fail_test("document parsed from file to equal document parsed from string", "unequal documents");
+    }
+    if (expected != stream_document) {
+        fail_test("document parsed from file stream to equal document parsed from string", "unequal documents");
+    }
+}
+
+void test_write_document() {
+    auto str = records_document(5000, " Kind=\"a &amp; &quot;b&quot;\"", [](int i) {
+        return "\n  <Name>Record number " + std::to_string(i) + " &lt;text&gt;</Name><!-- comment -->\n";
+    });
+    auto document = xtree::Document::from_string(str);
+    auto serialized = document.serialize();
+
+    // the output is larger than a block, so the stream and file descriptor receive it over several flushes
+    std::ostringstream stream;
+    stream << document;
+    if (stream.str() != serialized) {
+        fail_test("document written to a stream to equal the serialized document", "unequal output");
+    }
+
+    FILE* file = std::tmpfile();
+    document.write(fileno(file));
+    std::string written(serialized.size() + 1, '\0');
+    std::rewind(file);
+    written.resize(std::fread(written.data(), 1, written.size(), file));
+    std::fclose(file);
+    if (written != serialized) {
+        fail_test("document written to a file descriptor to equal the serialized document", "unequal output");
+    }
+
+    if (xtree::Document::from_string(serialized) != document) {
+        fail_test("serialized document to parse to the same document", "unequal documents");
+    }
+
+    // a buffer that is too small is left untouched, and the size reported is enough to hold the output
+    std::string buffer(16, '#');
+    auto required = document.serialize_to(buffer.data(), buffer.size());
+    if (required != serialized.size() || buffer != std::string(16, '#')) {
+        fail_test(std::to_string(serialized.size()), std::to_string(required));
+    }
+    buffer.resize(required);
+    document.serialize_to(buffer.data(), buffer.size());
+    if (buffer != serialized) {
+        fail_test("document serialized into a buffer to equal the serialized document", "unequal output");
+    }
+
+    auto& record = document.expect_root().nth_child(0);
+    std::string record_buffer(record.serialize_to(nullptr, 0), '\0');
+    record.serialize_to(record_buffer.data(), record_buffer.size());
+    if (record_buffer != record.serialize()) {
+        fail_test(record.serialize(), record_buffer);
+    }
+}
+
+void test_compact_output() {
+    auto str = records_document(1000, " Kind=\"it's a &gt; &amp; &quot;b&quot;\"", [](int i) {
+        return "<Name>Record 'number' " + std::to_string(i) + " &lt;text&gt; ]]&gt;</Name><!-- comment -->";
+    });
+    str.insert(str.find("<Records>"), "<!DOCTYPE Records>");
+    auto document = xtree::Document::from_string(str);
+
+    auto compact = document.serialize(xtree::OutputStyle::Compact);
+    if (compact.size() >= document.serialize().size()) {
+        fail_test("compact output to be smaller than padded output", std::to_string(compact.size()));
+    }
+    if (xtree::Document::from_string(compact) != document) {
+        fail_test("compact output to parse to the same document", "unequal documents");
+    }
+
+    auto& record = document.expect_root().nth_child(0);
+    std::string expected =
+        "<Record Id=\"0\" Kind=\"it's a > &amp; &quot;b&quot;\">"
+        "<Name>Record 'number' 0 &lt;text> ]]&gt;</Name><!--comment--></Record>";
+    if (record.serialize(xtree::OutputStyle::Compact) != expected) {
+        fail_test(expected, record.serialize(xtree::OutputStyle::Compact));
+    }
+
+    std::string buffer(document.serialize_to(nullptr, 0, xtree::OutputStyle::Compact), '\0');
+    document.serialize_to(buffer.data(), buffer.size(), xtree::OutputStyle::Compact);
+    if (buffer != compact) {
+        fail_test("compact output serialized into a buffer to equal the compact output", "unequal output");
+    }
+
+    FILE* file = std::tmpfile();
+    document.write(fileno(file), xtree::OutputStyle::Compact);
+    std::string written(compact.size() + 1, '\0');
+    std::rewind(file);
+    written.resize(std::fread(written.data(), 1, written.size(), file));
+    std::fclose(file);
+    if (written != compact) {
+        fail_test("compact output written to a file descriptor to equal the compact output", "unequal output");
+    }
+}
+
+void test_parallel_serialize() {
+    auto str = records_document(20000, "", [](int i) {
+        return "<Name>Record &lt;" + std::to_string(i) + "&gt;</Name>";
+    });
+    // the records are wrapped in a single elem, so the ranges are taken from its children rather than the root's
+    str.replace(str.find("<Records>"), 9, "<!-- prolog --><Export><Records Kind=\"all\">");
+    str += "</Export>";
+    // loose text and comments between the records, so the ranges written on every thread start and end on them too
+    for (int i = 0; i < 20000; i += 1000)
+        str.insert(str.find("<Record Id=\"" + std::to_string(i) + "\""), "loose text<!-- comment -->");
+    auto document = xtree::Document::from_string(str);
+
+    for (auto style: {xtree::OutputStyle::Padded, xtree::OutputStyle::Compact}) {
+        auto expected = document.serialize(style);
+        for (size_t thread_count: {0, 1, 3, 8}) {
+            if (document.serialize_parallel(thread_count, style) != expected) {
+                fail_test("document serialized in parallel to equal the serialized document", std::to_string(thread_count));
+            }
+        }
+    }
+
+    // too few children to split, and no root at all
+    auto small = xtree::Document::from_string("<Root><A/><B>text</B></Root>");
+    if (small.serialize_parallel(4) != small.serialize()) {
+        fail_test(small.serialize(), small.serialize_parallel(4));
+    }
+    if (!xtree::Document().serialize_parallel(4).empty()) {
+        fail_test("empty document to serialize to an empty string", xtree::Document().serialize_parallel(4));
+    }
+}
+
+void test_parallel_parse() {
+    auto str = records_document(20000, "", [](int i) {
+        auto content = "\n  <Name>Record number " + std::to_string(i) + " &lt;text&gt;</Name>\n"
+            "  <Nested><Deeper><Deepest>" + std::to_string(i) + "</Deepest></Deeper></Nested>\n";
+        // markup that looks like a node boundary, which a fragment may wrongly start at
+        if (i % 1000 == 0)
+            content += "  <!-- <Fake></Fake> --><Data><![CDATA[<Fake>\n<Fake/>]]></Data>\n";
+        return content;
+    });
+    str += "<!-- after root -->\n";
+
+    auto expected = xtree::Document::from_buffer(str.data(), str.size());
+    auto document = xtree::Document::from_buffer_parallel(str.data(), str.size(), 4);
+    if (expected != document) {
+        fail_test("document parsed in parallel to equal document parsed in order", "unequal documents");
+    }
+
+    // a malformed document throws the same exception as when it is parsed in order
+    auto pos = str.find("</Name>", str.size() / 2);
+    str.replace(pos, 7, "</Nome>");
+
+    std::string expected_error;
+    std::string actual_error;
+    try {
+        xtree::Document::from_buffer(str.data(), str.size());
+    } catch (xtree::ParseException& ex) {
+        expected_error = ex.what();
+    }
+    try {
+        xtree::Document::from_buffer_parallel(str.data(), str.size(), 4);
+    } catch (xtree::ParseException& ex) {
+        actual_error = ex.what();
+    }
+    if (expected_error.empty() || expected_error != actual_error) {
+        fail_test(expected_error, actual_error);
+    }
+}
+
+void test_push_parser() {
+    std::string str =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<!DOCTYPE Tests>\n"
+        "<Tests Id=\"1\" Kind=\"a &amp; b\">\n"
+        "  <Test Name=\"First\" Note='a > \"b\"'> Some &lt;text&gt; > </Test>\n"
+        "  <Empty/>\n"
+        "  <!-- a > comment -->\n"
+        "  <Data><![CDATA[raw <data> ]] here]]></Data>\n"
+        "</Tests>\n"
+        "<!-- after root -->\n";
+
+    auto expected = xtree::Document::from_string(str);
+
+    // every chunk size cuts the input in the middle of some token
+    for (size_t chunk_size = 1; chunk_size <= 16; chunk_size++) {
+        xtree::PushParser parser;
+        for (size_t i = 0; i < str.size(); i += chunk_size)
+            parser.feed(str.data() + i, std::min(chunk_size, str.size() - i));
+        auto document = parser.finish();
+
+        if (expected != document) {
+            fail_test(expected.serialize(), document.serialize());
+        }
+    }
+
+    // nodes much larger than a chunk are scanned as they arrive, so feeding them takes time linear in their size
+    auto push_time = [](size_t size) {
+        std::string filler;
+        while (filler.size() < size)
+            filler += "some data > with a tag end ";
+        auto large = "<Tests><Data><![CDATA[" + filler + "]]></Data><Text>" + filler + "</Text><!--" + filler
+            + "--><Test Name=\"" + filler + "\"/></Tests>";
+
+        auto best = std::chrono::steady_clock::duration::max();
+        for (int run = 0; run < 3; run++) {
+            auto start = std::chrono::steady_clock::now();
+            xtree::PushParser parser;
+            for (size_t i = 0; i < large.size(); i += 4096)
+                parser.feed(large.data() + i, std::min<size_t>(4096, large.size() - i));
+            auto document = parser.finish();
+            best = std::min(best, std::chrono::steady_clock::now() - start);
+
+            if (document != xtree::Document::from_string(large)) {
+                fail_test("large nodes fed in chunks to parse to the same document", "unequal documents");
+            }
+        }
+        return best;
+    };
+    auto small_time = push_time(1 << 18);
+    auto large_time = push_time(1 << 21);
+    if (large_time > small_time * 24) {
+        fail_test("feeding nodes 8 times larger to take about 8 times longer",
+            std::to_string(std::chrono::duration<double, std::milli>(small_time).count()) + " ms, "
+                + std::to_string(std::chrono::duration<double, std::milli>(large_time).count()) + " ms");
+    }
+
+    // a malformed document is reported as soon as the malformed node is fed
+    std::string malformed = "<Tests><Test></Tset>";
+    xtree::PushParser parser;
+    try {
+        parser.feed(malformed.data(), malformed.size());
+        fail_test("feeding a mismatched tag to throw", "no exception");
+    } catch (xtree::ParseException& ex) {
+        if (ex.code != xtree::ParseError::CloseTagMismatch) {
+            fail_test("CloseTagMismatch", ex.what());
+        }
+    }
+
+    // an unfinished document is only reported when it is finished
+    std::string unfinished = "<Tests><Test>";
+    xtree::PushParser unfinished_parser;
+    unfinished_parser.feed(unfinished.data(), unfinished.size());
+    try {
+        unfinished_parser.finish();
+        fail_test("finishing an unclosed document to throw", "no exception");
+    } catch (xtree::ParseException& ex) {
+        if (ex.code != xtree::ParseError::EndOfStream) {
+            fail_test("EndOfStream", ex.what());
+        }
+    }
+}
+
+void test_lazy_document() {
+    std::string str =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<!DOCTYPE Tests>\n"
+        "<!-- Before root -->\n"
+        "<Tests Id=\"1\" Kind=\"a &amp; b > c\">\n"
+        "  <Test Name=\"First\"> Some &lt;text&gt; </Test>\n"
+        "  <Empty Name='/>'/>\n"
+        "  <!-- <Fake> -->\n"
+        "  <Data><![CDATA[raw <Fake> ]]> text <Nested><Deeper/></Nested> tail</Data>\n"
+        "  <Broken><Inner></Inenr></Broken>\n"
+        "</Tests>\n"
+        "<!-- after root -->\n";
+
+    auto document = xtree::LazyDocument::from_buffer(str.data(), str.size());
+    auto& root = document.expect_root();
+
+    if (root.tag() != "Tests" || root.expect_attr("Kind").value != "a & b > c") {
+        fail_test("Tests a & b > c", std::string(root.tag()) + " " + std::string(root.expect_attr("Kind").value));
+    }
+    if (document.children.size() != 4) {
+        fail_test("4 nodes outside the root", std::to_string(document.children.size()));
+    }
+
+    auto& data = root.expect_elem("Data");
+    if (data.children().size() != 3 || data.children()[0].as_text().data != "raw <Fake>  text") {
+        fail_test("raw <Fake>  text", std::string(data.children()[0].as_text().data));
+    }
+
+    // only the elems that were accessed are parsed
+    auto& test = root.expect_elem("Test");
+    auto& nested = data.expect_elem("Nested");
+    if (test.children_parsed || nested.children_parsed || !nested.tag_parsed) {
+        fail_test("only the accessed elems to be parsed", "unaccessed elems were parsed");
+    }
+
+    // malformed content is only reported once the elem holding it is parsed, at its position in the entire input
+    try {
+        root.expect_elem("Broken").expect_elem("Inner").children();
+        fail_test("parsing a mismatched tag to throw", "no exception");
+    } catch (xtree::ParseException& ex) {
+        if (ex.code != xtree::ParseError::CloseTagMismatch || std::string(ex.what()).find("at row: 9, col: 25") == std::string::npos) {
+            fail_test("CloseTagMismatch at row: 9, col: 25", ex.what());
+        }
+    }
+
+    auto fixed = str;
+    fixed.replace(fixed.find("</Inenr>"), 8, "</Inner>");
+    auto lazy_document = xtree::LazyDocument::from_buffer(fixed.data(), fixed.size());
+    auto expected = xtree::Document::from_string(fixed);
+    auto actual = lazy_document.to_document();
+    if (expected != actual) {
+        fail_test(expected.serialize(), actual.serialize());
+    }
+
+    // unbalanced tags are reported by the index pass
+    std::string unclosed = "<Tests><Test></Tests>";
+    try {
+        xtree::LazyDocument::from_buffer(unclosed.data(), unclosed.size());
+        fail_test("indexing an unclosed elem to throw", "no exception");
+    } catch (xtree::ParseException& ex) {
+        if (ex.code != xtree::ParseError::EndOfStream) {
+            fail_test("EndOfStream", ex.what());
+        }
+    }
+}
+
+void test_interned_names() {
+    std::string str =
+        "<Tests Id=\"1\">"
+        "<Test Name=\"First\"/>"
+        "<Test Name=\"Second\"><Name>Inner</Name></Test>"
+        "</Tests>";
+
+    auto first = xtree::DocumentView::from_buffer_interned(str.data(), str.size());
+    auto second = xtree::DocumentView::from_buffer_interned(str.data(), str.size());
+
+    auto& first_root = first.expect_root();
+    auto& second_root = second.expect_root();
+
+    // the names of both documents share a single copy in the symbol table
+    if (first_root.symbol != second_root.symbol || first_root.tag.data() != second_root.tag.data() || first_root.tag.data() == str.data() + 1) {
+        fail_test("interned names to be shared between documents", "names were not shared");
+    }
+
+    auto test = xtree::SymbolTable::intern("Test");
+    auto name = xtree::SymbolTable::find("Name");
+    if (!name.has_value() || first_root.expect_elem(test).expect_attr(*name).value != "First") {
+        fail_test("First", "a different attr");
+    }
+    if (xtree::SymbolTable::find("Unused name").has_value()) {
+        fail_test("a name that was never interned to not be found", "found the name");
+    }
+
+    if (first.to_document() != xtree::Document::from_string(str)) {
+        fail_test(str, first.to_document().serialize());
+    }
+
+    // names interned from several threads at once get a single symbol each
+    std::vector<std::thread> threads;
+    std::vector<std::vector<xtree::Symbol>> symbols(4);
+    for (size_t i = 0; i < symbols.size(); i++) {
+        threads.emplace_back([&symbols, i] {
+            for (int j = 0; j < 1000; j++)
+                symbols[i].push_back(xtree::SymbolTable::intern("Name" + std::to_string(j)));
+        });
+    }
+    for (auto& thread: threads)
+        thread.join();
+
+    for (size_t i = 1; i < symbols.size(); i++) {
+        if (symbols[i] != symbols[0]) {
+            fail_test("every thread to get the same symbols", "different symbols");
+        }
+    }
+    if (symbols[0][999].name() != "Name999") {
+        fail_test("Name999", std::string(symbols[0][999].name()));
+    }
+}
+
+void test_flat_document() {
+    std::string str =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<!DOCTYPE Tests>\n"
+        "<!-- Before root -->\n"
+        "<Tests Id=\"1\" Kind=\"a &amp; b\">\n"
+        "  <Test Name=\"First\"> Some &lt;text&gt; </Test>\n"
+        "  <Empty/>\n"
+        "  <!-- Inside -->\n"
+        "  <Data><Nested><Deeper/></Nested> tail</Data>\n"
+        "</Tests>\n";
+
+    auto document = xtree::FlatDocument::from_string(str);
+    auto expected = xtree::Document::from_string(str);
+
+    if (document.to_document() != expected) {
+        fail_test(expected.serialize(), document.to_document().serialize());
+    }
+    if (document.serialize() != expected.serialize()) {
+        fail_test(expected.serialize(), document.serialize());
+    }
+
+    auto root = document.expect_root();
+    if (root.expect_attr("Kind").value != "a & b" || root.expect_elem("Test").nth_child(0).as_text().data != "Some <text>") {
+        fail_test("a & b and Some <text>", "different attr or text");
+    }
+    if (root.select_elem("Missing").has_value() || root.expect_elem("Data").expect_elem("Nested").expect_elem("Deeper").tag() != "Deeper") {
+        fail_test("Deeper", "a different elem");
+    }
+
+    size_t elems_count = 0;
+    xtree::walk_document(document, [&elems_count](xtree::FlatNodeRef node) {
+        if (node.is_elem())
+            elems_count++;
+    });
+    if (elems_count != 6) {
+        fail_test("6 elems", std::to_string(elems_count));
+    }
+
+    auto stats = xtree::stat_document(document);
+    if (stats.nodes_count != xtree::stat_document(expected).nodes_count) {
+        fail_test(std::to_string(xtree::stat_document(expected).nodes_count), std::to_string(stats.nodes_count));
+    }
+
+    auto other = xtree::FlatDocument::from_string(str);
+    if (document != other) {
+        fail_test("documents parsed from the same string to be equal", "unequal documents");
+    }
+    str.replace(str.find("tail"), 4, "tall");
+    if (document == xtree::FlatDocument::from_string(str)) {
+        fail_test("documents with different text to be unequal", "equal documents");
+    }
+}
+
 void test_decl() {
     auto str =
         "<?xml version=\"1.0\" encoding=\"UTF-8\" ?>"
@@ -302,6 +873,262 @@ void test_multiple_roots() {
     }
 }
 
+void test_try_parse() {
+    std::string str = "<Test Id=\"1\">\n  <Name>a &amp; b</Name>\n</Test>";
+    auto result = xtree::Document::try_from_string(str);
+    if (!result || result.value() != xtree::Document::from_string(str)) {
+        fail_test("document parsed without throwing to equal the thrown parse", "unequal documents");
+    }
+
+    // a failure carries the same code, offset and message as the exception the throwing parse raises
+    for (auto invalid: {"<Test>\n  <Name>a &bogus; b</Name>\n</Test>", "<Test>\n  <Name/>\n</Test1>", "<Test a=\"1\">", "<Test/><Test/>"}) {
+        std::string invalid_str = invalid;
+        auto failed = xtree::Document::try_from_string(invalid_str, xtree::CapacityPolicy::Presize);
+        auto failed_view = xtree::DocumentView::try_from_buffer(invalid_str.data(), invalid_str.size());
+        if (failed || failed_view) {
+            fail_test("failed parse", "parsed document");
+            continue;
+        }
+
+        try {
+            xtree::Document::from_string(invalid_str);
+            fail_test("parse exception", "no exception");
+        } catch (xtree::ParseException& ex) {
+            auto& error = failed.error();
+            if (error.code != ex.code || error.offset != ex.offset || error.message() != ex.what()) {
+                fail_test(ex.what(), error.message());
+            }
+            if (failed_view.error().message() != ex.what()) {
+                fail_test(ex.what(), failed_view.error().message());
+            }
+        }
+
+        try {
+            failed.value();
+            fail_test("value of a failed parse to throw", "no exception");
+        } catch (xtree::ParseException& ex) {
+            if (ex.what() != failed.error().message()) {
+                fail_test(failed.error().message(), ex.what());
+            }
+        }
+    }
+}
+
+bool points_into(std::string_view view, const std::string& buffer) {
+    return view.data() >= buffer.data() && view.data() + view.size() <= buffer.data() + buffer.size();
+}
+
+void test_document_view() {
+    std::string str =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+        "<!DOCTYPE Tests>"
+        "<Tests Id=\"123\" Name=\"a &amp; b\">"
+        "<!-- A comment -->"
+        "<Test TestId=\"0001\"> Plain text </Test>"
+        "<Test TestId=\"0002\"> Escaped &lt;text&gt; </Test>"
+        "<Test TestId=\"0003\"><![CDATA[Only cdata]]></Test>"
+        "<Empty/>"
+        "</Tests>";
+
+    auto view = xtree::DocumentView::from_buffer(str.data(), str.size());
+    auto expected = xtree::Document::from_string(str);
+
+    auto document = view.to_document();
+    if (expected != document) {
+        fail_test(expected.serialize(), document.serialize());
+    }
+
+    auto& root = view.expect_root();
+    if (!points_into(root.tag, str) || !points_into(root.expect_attr("Id").value, str)) {
+        fail_test("unescaped strings to be borrowed from the input", "copied strings");
+    }
+    if (points_into(root.expect_attr("Name").value, str) || root.expect_attr("Name").value != "a & b") {
+        fail_test("escaped attr value to be copied and decoded", std::string(root.expect_attr("Name").value));
+    }
+
+    auto& plain = root.nth_child(1).as_elem().nth_child(0).as_text();
+    auto& escaped = root.nth_child(2).as_elem().nth_child(0).as_text();
+    auto& cdata = root.nth_child(3).as_elem().nth_child(0).as_text();
+    if (!points_into(plain.data, str) || plain.data != "Plain text") {
+        fail_test("plain text to be borrowed from the input", std::string(plain.data));
+    }
+    if (points_into(escaped.data, str) || escaped.data != "Escaped <text>") {
+        fail_test("escaped text to be copied and decoded", std::string(escaped.data));
+    }
+    if (!points_into(cdata.data, str) || cdata.data != "Only cdata") {
+        fail_test("cdata text to be borrowed from the input", std::string(cdata.data));
+    }
+
+    auto stats = xtree::stat_document(view);
+    if (stats.nodes_count != 11) {
+        fail_test("11 nodes", std::to_string(stats.nodes_count) + " nodes");
+    }
+
+    view.clear();
+    if (view.root != nullptr || !view.children.empty() || view.arena->allocated != 0) {
+        fail_test("an empty document after clear", "nodes or arena memory left");
+    }
+
+    // a moved from document can be cleared and reused
+    auto moved_from = xtree::DocumentView::from_buffer(str.data(), str.size());
+    auto moved_to = std::move(moved_from);
+    moved_from.clear();
+    if (moved_from.arena == nullptr || moved_to.expect_root().tag != "Tests") {
+        fail_test("a moved from document to be given a new arena on clear", "no arena");
+    }
+}
+
+void test_mutable_buffer() {
+    std::string str =
+        "<Tests Name=\"a &amp; b &quot;c&quot;\">"
+        "<Test> &lt;Escaped&gt; text <![CDATA[ and <cdata> ]]> merged </Test>"
+        "<Test>&amp;<![CDATA[]]>&amp;</Test>"
+        "<!-- A comment -->"
+        "</Tests>";
+
+    auto expected = xtree::Document::from_string(str);
+
+    std::string buffer = str;
+    auto view = xtree::DocumentView::from_mutable_buffer(buffer.data(), buffer.size());
+
+    auto document = view.to_document();
+    if (expected != document) {
+        fail_test(expected.serialize(), document.serialize());
+    }
+
+    auto& root = view.expect_root();
+    auto& text = root.nth_child(0).as_elem().nth_child(0).as_text();
+    if (!points_into(root.expect_attr("Name").value, buffer) || !points_into(text.data, buffer)) {
+        fail_test("decoded strings to point into the buffer", "strings outside of the buffer");
+    }
+}
+
+struct LogHandler : public xtree::SaxHandler {
+    std::string log;
+
+    void on_decl(std::string_view tag, const std::vector<xtree::AttrView>& attrs) override {
+        log += "decl:" + std::string(tag) + attrs_to_log(attrs) + "\n";
+    }
+
+    void on_dtd(std::string_view data) override {
+        log += "dtd:" + std::string(data) + "\n";
+    }
+
+    void on_open(std::string_view tag, const std::vector<xtree::AttrView>& attrs) override {
+        log += "open:" + std::string(tag) + attrs_to_log(attrs) + "\n";
+    }
+
+    void on_close(std::string_view tag) override {
+        log += "close:" + std::string(tag) + "\n";
+    }
+
+    void on_text(std::string_view data) override {
+        log += "text:" + std::string(data) + "\n";
+    }
+
+    void on_cmnt(std::string_view data) override {
+        log += "cmnt:" + std::string(data) + "\n";
+    }
+
+    static std::string attrs_to_log(const std::vector<xtree::AttrView>& attrs) {
+        std::string str;
+        for (auto& attr: attrs)
+            str += " " + std::string(attr.name) + "=" + std::string(attr.value);
+        return str;
+    }
+};
+
+void test_sax_events() {
+    std::string str =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+        "<!DOCTYPE Tests>"
+        "<!-- Before root -->"
+        "<Tests Id=\"1\" Kind=\"a &amp; b\">"
+        "<Test> Some text </Test>"
+        "<Empty/>"
+        "<!-- Inside -->"
+        "<![CDATA[<raw>]]>"
+        "</Tests>";
+
+    std::string expected =
+        "decl:xml version=1.0 encoding=UTF-8\n"
+        "dtd:Tests\n"
+        "cmnt:Before root\n"
+        "open:Tests Id=1 Kind=a & b\n"
+        "open:Test\n"
+        "text:Some text\n"
+        "close:Test\n"
+        "open:Empty\n"
+        "close:Empty\n"
+        "cmnt:Inside\n"
+        "text:<raw>\n"
+        "close:Tests\n";
+
+    LogHandler buffer_handler;
+    xtree::sax_from_buffer(str.data(), str.size(), buffer_handler);
+    if (buffer_handler.log != expected) {
+        fail_test(expected, buffer_handler.log);
+    }
+
+    std::istringstream stream(str);
+    LogHandler stream_handler;
+    xtree::sax_from_stream(stream, stream_handler);
+    if (stream_handler.log != expected) {
+        fail_test(expected, stream_handler.log);
+    }
+}
+
+void test_xml_reader() {
+    std::string str =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+        "<Tests Id=\"1\">"
+        "<Skipped><Test>Deep<Test/></Test><!-- Inside --></Skipped>"
+        "<Empty/>"
+        "<Test Name=\"Last\"> Some text </Test>"
+        "</Tests>";
+
+    std::string log;
+    xtree::XmlReader reader(str.data(), str.size());
+    while (reader.next() != xtree::NodeKind::End) {
+        switch (reader.kind()) {
+        case xtree::NodeKind::Decl:
+            log += "decl:" + std::string(reader.name()) + "\n";
+            break;
+        case xtree::NodeKind::Open:
+            log += "open:" + std::string(reader.name()) + " " + std::to_string(reader.depth());
+            if (auto attr = reader.select_attr("Name"))
+                log += " " + std::string(attr->value);
+            log += "\n";
+            if (reader.name() == "Skipped" || reader.name() == "Empty")
+                reader.skip_subtree();
+            break;
+        case xtree::NodeKind::Close:
+            log += "close:" + std::string(reader.name()) + " " + std::to_string(reader.depth()) + "\n";
+            break;
+        case xtree::NodeKind::Text:
+            log += "text:" + std::string(reader.text()) + "\n";
+            break;
+        default:
+            log += "other\n";
+            break;
+        }
+    }
+
+    std::string expected =
+        "decl:xml\n"
+        "open:Tests 1\n"
+        "open:Skipped 2\n"
+        "open:Empty 2\n"
+        "open:Test 2 Last\n"
+        "text:Some text\n"
+        "close:Test 1\n"
+        "close:Tests 0\n";
+
+    if (log != expected) {
+        fail_test(expected, log);
+    }
+}
+
 void test_copy_node() {
     auto child = xtree::Elem("Child", {{"Name", "Joseph"}});
 
@@ -339,6 +1166,48 @@ void test_utf8_document() {
     }
 }
 
+void test_utf8_names() {
+    std::string str = "<Größe Länge=\"1\"><名前 値=\"a\">世界</名前><x·y/></Größe>";
+
+    xtree::Document expected;
+    auto root = xtree::Elem("Größe")
+        .add_attr("Länge", "1")
+        .add_node(xtree::Elem("名前").add_attr("値", "a").add_node(xtree::Text("世界")))
+        .add_node(xtree::Elem("x·y"));
+    expected.add_root(std::move(root));
+
+    auto document = xtree::Document::from_string(str);
+    if (expected != document) {
+        fail_test(expected.serialize(), document.serialize());
+    }
+
+    // names read from a stream are decoded through the parser's lookahead rather than the input
+    auto file_path = "test_utf8_names.xml";
+    {
+        std::ofstream out(file_path);
+        out << str;
+    }
+    std::ifstream file(file_path);
+    auto stream_document = xtree::Document::from_file(file);
+    file.close();
+    std::remove(file_path);
+    if (expected != stream_document) {
+        fail_test(expected.serialize(), stream_document.serialize());
+    }
+
+    // a middle dot may only follow the first character of a name, and a lone continuation byte is not a character
+    for (auto invalid: {"<·x/>", "<x\x80/>"}) {
+        try {
+            xtree::Document::from_string(invalid);
+            fail_test("invalid tag name exception", "no exception");
+        } catch (xtree::ParseException& ex) {
+            if (ex.code != xtree::ParseError::InvalidTagname) {
+                fail_test("invalid tag name exception", ex.what());
+            }
+        }
+    }
+}
+
 std::string vecstr_to_string(std::vector<std::string>& vecstr) {
     std::string str = "{ ";
     for (auto& s: vecstr)
@@ -715,10 +1584,13 @@ void test_stat_tree() {
     }
 }
 
-size_t allocated = 0;
+// counted atomically since the parallel parse and symbol table tests allocate from several threads
+std::atomic<size_t> allocated = 0;
+std::atomic<size_t> allocations = 0;
 
 void* operator new(size_t size) {
     allocated += size;
+    allocations++;
     return malloc(size);
 }
 
@@ -728,7 +1600,7 @@ void operator delete(void* memory, size_t size) noexcept {
 }
 
 void test_destructor() {
-    auto size1 = allocated;
+    size_t size1 = allocated;
     {
         xtree::Document document;
         auto root = xtree::Elem("One")
@@ -739,13 +1611,108 @@ void test_destructor() {
             .add_node(xtree::Elem("Three"))
             .add_node(xtree::Elem("Four"));
     }
-    auto size2 = allocated;
+    size_t size2 = allocated;
 
     if (size2 - size1 != 0) {
         fprintf(stderr, "Expected alloc size difference to be 0, got: %zd\n", size2 - size1);
     }
 }
 
+size_t count_spare_capacity(const xtree::Elem& elem) {
+    size_t spare = elem.attrs.capacity() - elem.attrs.size() + elem.children.capacity() - elem.children.size();
+    for (auto& child: elem.children)
+        if (child.is_elem())
+            spare += count_spare_capacity(child.as_elem());
+    return spare;
+}
+
+// the allocations an owning document cannot do without, one for each elem and one for each of its vectors that is not empty
+// every name and value in the capacity policy test is short enough to be stored inline in its string
+size_t count_node_allocations(const xtree::Elem& elem) {
+    size_t count = 1 + !elem.attrs.empty() + !elem.children.empty();
+    for (auto& child: elem.children)
+        if (child.is_elem())
+            count += count_node_allocations(child.as_elem());
+    return count;
+}
+
+void test_capacity_policy() {
+    auto str = records_document(100, "", [](int) {
+        std::string content;
+        for (int j = 0; j < 10; j++)
+            content += "<Field Id=\"" + std::to_string(j) + "\">" + std::to_string(j) + "</Field>\n";
+        return content;
+    });
+
+    auto slack = xtree::Document::from_string(str, xtree::CapacityPolicy::Slack);
+    auto compact = xtree::Document::from_string(str, xtree::CapacityPolicy::Compact);
+    auto presize = xtree::Document::from_string(str, xtree::CapacityPolicy::Presize);
+
+    if (slack != compact || presize != compact) {
+        fail_test("documents parsed with each capacity policy to be equal", "unequal documents");
+    }
+    if (count_spare_capacity(*compact.root) != 0 || count_spare_capacity(*presize.root) != 0) {
+        fail_test("no spare capacity in compacted or presized documents", "spare capacity");
+    }
+
+    // the baseline reallocated each children vector as it grew, then once more to shrink it when its elem was closed
+    // the default presizes each vector, so past the nodes themselves it only allocates a few buffers for the pre-scan and parser
+    size_t allocations1 = allocations;
+    auto document = xtree::Document::from_string(str);
+    size_t default_count = allocations - allocations1;
+    size_t node_count = count_node_allocations(*document.root);
+    if (default_count > node_count + 64) {
+        fail_test("at most " + std::to_string(node_count + 64) + " allocations to parse with the default policy",
+            std::to_string(default_count));
+    }
+}
+
+void test_stream_small_nodes() {
+    // a node streamed on its own buffers only its own output, not a whole block
+    std::ostringstream stream;
+    xtree::Attr attr("Id", "1");
+    xtree::Text text("short");
+    size_t allocations1 = allocations;
+    for (int i = 0; i < 1000; i++)
+        stream << attr << text;
+    size_t count = allocations - allocations1;
+    if (count > 100) {
+        fail_test("at most 100 allocations to stream 2000 small nodes", std::to_string(count));
+    }
+}
+
+void test_validate() {
+    auto str = records_document(5000, " Kind=\"a &amp; b\"", [](int i) {
+        return "\n  <Name>Record number " + std::to_string(i) + " &lt;text&gt;</Name>\n"
+            "  <!-- comment --><Data><![CDATA[raw <data>]]></Data>\n";
+    });
+
+    // the memory used to validate depends on the depth of the document and the size of its tokens, not the number of nodes
+    size_t allocations1 = allocations;
+    auto failure = xtree::validate(str.data(), str.size());
+    size_t count = allocations - allocations1;
+    if (failure) {
+        fail_test("valid document", failure->message());
+    }
+    if (count > 16) {
+        fail_test("at most 16 allocations to validate", std::to_string(count));
+    }
+
+    // a malformed document fails with the same code and offset as a parse
+    for (auto invalid: {"<Test><Name></Test>", "<Test a=\"&x;\"/>", "<Test><!bad></Test>", "<Test/><Test/>", "<Test>"}) {
+        std::string invalid_str = invalid;
+        auto validate_failure = xtree::validate(invalid_str.data(), invalid_str.size());
+        auto result = xtree::Document::try_from_string(invalid_str);
+        if (!validate_failure || result) {
+            fail_test("malformed document", invalid_str);
+            continue;
+        }
+        if (validate_failure->code != result.error().code || validate_failure->offset != result.error().offset) {
+            fail_test(result.error().message(), validate_failure->message());
+        }
+    }
+}
+
 int main() {
     auto start = std::chrono::steady_clock::now();
 
@@ -754,12 +1721,31 @@ int main() {
         test_unopened_tag();
         test_cdata();
         test_begin_cdata();
+        test_cdata_brackets();
+        test_long_text();
+        test_error_position();
+        test_large_file();
+        test_write_document();
+        test_compact_output();
+        test_parallel_serialize();
+        test_parallel_parse();
+        test_push_parser();
+        test_lazy_document();
+        test_interned_names();
+        test_flat_document();
+        test_document_view();
+        test_mutable_buffer();
+        test_sax_events();
+        test_xml_reader();
         test_dtd();
         test_utf8_document();
+        test_utf8_names();
         test_escseq();
+        test_char_refs();
         test_unclosed();
         test_unequal_tags();
         test_multiple_roots();
+        test_try_parse();
         test_decl();
         test_larger_doc();
         test_complex_doc();
@@ -776,6 +1762,9 @@ int main() {
         test_stat_tree();
         test_normalize();
         test_destructor();
+        test_capacity_policy();
+        test_validate();
+        test_stream_small_nodes();
     } catch (std::exception& ex) {
         std::cerr << ex.what() << std::endl;
     }